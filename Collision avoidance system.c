@@ -1,6 +1,23 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#ifdef TELEMETRY_STANDIN_SERVER
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#endif
 #include "ultrasonic_sensor.h" // Simulated ultrasonic sensor library
 #include "motor_control.h"    // Simulated motor control module
 #include "buzzer_alert.h"     // Simulated buzzer alert system
@@ -13,6 +30,147 @@
 
 #define SAFE_DISTANCE 30 // Safe distance in cm
 
+#define NUM_ULTRASONIC 12           // Ultrasonic sensors around the bumpers
+#define ULTRASONIC_MAX_RANGE 400.0f // cm, readings at or beyond this are "no echo"
+#define RANGE_NOISE_VAR 4.0f        // Ultrasonic range variance, cm^2
+#define ACCEL_NOISE 300.0f          // Unmodelled relative acceleration, cm/s^2
+#define TTC_BRAKE_S 1.2f            // Emergency brake below this time-to-collision
+#define TTC_SLOW_S 3.0f             // Cruise control backs off below this
+#define TTC_NONE 1.0e9f             // Not closing
+#define FUSION_MAX_MISSES 25.0f     // Control cycles a track coasts on prediction without an echo
+#define CRUISE_SPEED_MAX 50         // km/h
+#define CRUISE_PERIOD_US 20000
+#define CRUISE_DECEL_KMH_S 10.0f    // Back-off and recovery rates, applied per
+#define CRUISE_ACCEL_KMH_S 5.0f     // cruise period so they hold at any task rate
+
+#define INFERENCE_CPU 2                 // Core reserved for obstacle recognition
+#define MODEL_PATH "obstacle_cnn.qnn"   // Quantized classifier, see model_load()
+#define MODEL_MAX_BYTES (256 * 1024)
+#define MODEL_ARENA_BYTES (512 * 1024)  // Activations + im2col scratch + camera frame
+#define MODEL_MAX_LAYERS 16
+#define MODEL_MAX_SHIFT 31              // Keeps 31 + shift inside an int64_t shift
+#define OBSTACLE_MIN_CONFIDENCE 0.6f
+#define VULNERABLE_TTC_FACTOR 1.5f      // Brake earlier for pedestrians and cyclists
+
+#define TRACE_DIFF_TOLERANCE_US 50000   // Replayed actuation may shift by one slow-task period
+#define TRACE_RING_BYTES 65536          // Per-task record buffer, power of two
+#define TRACE_FLUSH_LAG_US 10000        // Records younger than this wait for the next flush
+#define MOTOR_STOP 0
+#define MOTOR_FORWARD 1
+
+#define CONTROL_RATE_HZ 500  // Distance sensing + braking loop rate
+#define CONTROL_CPU 1        // Core reserved (isolcpus=1) for the control loop
+#define RT_PRIORITY_TOP 90   // SCHED_FIFO priority of the fastest task
+#define JITTER_BUCKETS 16    // Power-of-two microsecond release jitter buckets
+
+#define TELEMETRY_URL "http://vehicle-alerts.com/api/logs"
+#define TELEMETRY_QUEUE_SIZE 4096        // Records, power of two
+#define TELEMETRY_BATCH_MAX 1024         // Records per upload
+#define TELEMETRY_SPOOL_PATH "telemetry.spool"
+#define TELEMETRY_SPOOL_MAX (4 * 1024 * 1024) // Bytes kept on disk while offline
+#define TELEMETRY_STANDIN_PORT 18080     // Local HTTP stand-in for bench runs
+
+typedef enum {
+    TRACE_RANGES = 1,
+    TRACE_GPS,
+    TRACE_LANE,
+    TRACE_OBSTACLE,
+    TRACE_ACTUATION
+} trace_type_t;
+
+typedef struct {
+    const char *name;
+    void (*run)();
+    uint32_t period_us;
+    int cpu;                 // Pinned core, -1 for any
+    bool live_only;          // Skipped when replaying a trace
+    trace_type_t replay_feed; // On replay, run once per due record of this type instead of periodically
+    int priority;            // Assigned rate-monotonically by start_scheduler()
+    pthread_t thread;
+    _Atomic uint64_t runs;
+    _Atomic uint32_t deadline_misses;
+    _Atomic uint32_t max_jitter_us;
+    _Atomic uint32_t jitter_hist[JITTER_BUCKETS];
+} rt_task_t;
+
+#define TELEMETRY_FLAG_BRAKE 0x01
+#define TELEMETRY_FLAG_OFF_CENTER 0x02
+#define TELEMETRY_CLASS_SHIFT 4         // Obstacle class in the upper nibble of flags
+
+typedef enum {
+    OBSTACLE_NONE,
+    OBSTACLE_VEHICLE,
+    OBSTACLE_PEDESTRIAN,
+    OBSTACLE_CYCLIST,
+    OBSTACLE_ANIMAL,
+    OBSTACLE_DEBRIS,
+    NUM_OBSTACLE_CLASSES
+} obstacle_class_t;
+
+typedef struct {
+    obstacle_class_t cls;
+    float confidence;
+    uint32_t timestamp_ms;
+} obstacle_result_t;
+
+typedef enum { TRACE_OFF, TRACE_RECORD, TRACE_REPLAY } trace_mode_t;
+
+typedef enum {
+    ACT_MOTOR,
+    ACT_BUZZER,
+    ACT_SPEED,
+    ACT_LANE_CORRECT,
+    NUM_ACTUATORS
+} actuator_t;
+
+typedef struct {
+    size_t pos;
+    uint64_t t_us;
+} trace_cursor_t;
+
+typedef struct {
+    _Alignas(64) _Atomic uint32_t head;  // Producer
+    _Alignas(64) _Atomic uint32_t tail;  // Flush task
+    uint8_t data[TRACE_RING_BYTES];
+} trace_ring_t;
+
+typedef struct {
+    uint64_t t_us;
+    int16_t value;
+} trace_actuation_t;
+
+typedef enum {
+    LAYER_CONV3X3 = 1, // 3x3, pad 1, optional stride
+    LAYER_MAXPOOL2 = 2,
+    LAYER_DENSE = 3
+} layer_type_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t stride;
+    uint8_t relu;
+    uint8_t shift;
+    uint16_t in_h, in_w, in_c;
+    uint16_t out_h, out_w, out_c;
+    int32_t multiplier;       // Requantization scale in Q31
+    const int32_t *bias;      // Points into model_blob
+    const int8_t *weights;
+} model_layer_t;
+
+// Fixed-size record produced once per control cycle
+typedef struct {
+    uint32_t timestamp_ms;
+    uint16_t distance;
+    uint8_t speed;
+    uint8_t flags;
+} telemetry_record_t;
+
+// Bounded lock-free MPSC ring; each cell's sequence number says who owns it
+typedef struct {
+    _Atomic uint32_t sequence;
+    telemetry_record_t record;
+} telemetry_cell_t;
+
 void init_system();
 void read_sensors();
 void control_vehicle();
@@ -21,93 +179,1598 @@ void update_gps_location();
 void adaptive_cruise_control();
 void lane_keeping_assist();
 void ai_obstacle_recognition();
+void control_task();
+void fusion_init();
+void fusion_update(float dt);
+#ifdef __AVX2__
+float hmin_ps(__m256 v);
+#endif
+obstacle_class_t obstacle_class_from_name(const char *name);
+void obstacle_publish(obstacle_class_t cls, float confidence);
+obstacle_result_t obstacle_latest();
+bool model_load(const char *path);
+float model_run(obstacle_class_t *cls);
+void print_scheduler_stats();
+bool start_scheduler();
+void *task_thread(void *arg);
+void record_jitter(rt_task_t *task, int64_t jitter_ns);
+int64_t timespec_diff_ns(const struct timespec *a, const struct timespec *b);
+void timespec_add_us(struct timespec *t, uint32_t us);
+uint32_t monotonic_ms();
+uint64_t now_us();
+void actuate(actuator_t actuator, int16_t value);
+bool trace_open(const char *path);
+bool trace_load(const char *path);
+void trace_write(trace_type_t type, const uint8_t *payload, size_t len);
+void trace_ring_put(trace_ring_t *ring, uint32_t pos, const void *bytes, size_t len);
+void trace_ring_get(const trace_ring_t *ring, uint32_t pos, void *bytes, size_t len);
+void trace_write_string(trace_type_t type, const char *text);
+void trace_flush();
+const uint8_t *trace_next(trace_type_t type, uint64_t *t_us, bool consume);
+bool trace_read_string(trace_type_t type, char *out, size_t size);
+void trace_check_actuation(actuator_t actuator, int16_t value);
+int replay_trace(double speed);
+uint8_t *put_uvarint(uint8_t *p, uint64_t value);
+void telemetry_init();
+bool telemetry_enqueue(const telemetry_record_t *record);
+bool telemetry_dequeue(telemetry_record_t *record);
+size_t telemetry_encode_batch(const telemetry_record_t *records, size_t count, uint8_t *out);
+size_t base64_encode(const uint8_t *in, size_t len, char *out);
+bool telemetry_post(const char *body);
+void telemetry_spool(const char *body);
+void telemetry_replay_spool();
+#ifdef TELEMETRY_STANDIN_SERVER
+void *standin_server_thread(void *arg);
+#endif
 
-uint16_t distance = 0;
-bool emergency_brake = false;
+_Atomic uint16_t distance = 0; // Nearest fused range, cm
+_Atomic float min_ttc = TTC_NONE; // Smallest time-to-collision over all sensors, s
+_Atomic bool emergency_brake = false;
+_Atomic bool scheduler_running = true;  // Cleared to stop every task at its next release
 char gps_location[50];
-uint8_t vehicle_speed = 50; // Default speed
-char detected_object[30];
+_Atomic uint8_t vehicle_speed = 50; // Default speed
+float cruise_speed = 50.0f;         // Unrounded, owned by the cruise task
+const char *obstacle_names[NUM_OBSTACLE_CLASSES] = {"None", "Vehicle", "Pedestrian", "Cyclist", "Animal", "Debris"};
 char lane_status[20];
+pthread_mutex_t state_lock = PTHREAD_MUTEX_INITIALIZER; // Guards the string fields above
+_Atomic bool lane_off_center = false;
+
+telemetry_cell_t telemetry_queue[TELEMETRY_QUEUE_SIZE];
+_Atomic uint32_t telemetry_head = 0; // Next slot to claim (producers)
+uint32_t telemetry_tail = 0;         // Next slot to drain (sender only)
+_Atomic uint32_t telemetry_dropped = 0;
+_Atomic uint32_t telemetry_batches_sent = 0;
+_Atomic uint32_t telemetry_batches_spooled = 0;
+_Atomic uint32_t telemetry_batches_lost = 0;
+_Atomic uint64_t telemetry_enqueue_ns = 0;  // Control loop time spent on telemetry
+_Atomic uint32_t telemetry_enqueue_max_ns = 0;
+long telemetry_spool_bytes = 0;
+
+// Constant-velocity Kalman filter per sensor, state [range, range rate] and the
+// symmetric covariance [p00 p01; p01 p11]. Kept as structure-of-arrays so
+// fusion_update() runs 8 sensors per AVX2 iteration, scalar for the rest.
+float kf_measured[NUM_ULTRASONIC];  // Latest raw reading, cm
+float kf_range[NUM_ULTRASONIC];     // cm
+float kf_rate[NUM_ULTRASONIC];      // cm/s, negative while closing
+float kf_p00[NUM_ULTRASONIC];
+float kf_p01[NUM_ULTRASONIC];
+float kf_p11[NUM_ULTRASONIC];
+float kf_ttc[NUM_ULTRASONIC];       // s
+float kf_misses[NUM_ULTRASONIC];    // Consecutive cycles without an echo, FUSION_MAX_MISSES = no track
+_Atomic uint32_t fusion_max_ns = 0;
+
+// Latest obstacle classification, published through a seqlock
+_Atomic uint32_t obstacle_seq = 0;
+_Atomic uint8_t obstacle_class_pub = OBSTACLE_NONE;
+_Atomic float obstacle_confidence_pub = 0.0f;
+_Atomic uint32_t obstacle_stamp_pub = 0;
+_Atomic uint32_t inference_max_us = 0;
+
+// Static memory plan for the int8 runtime; nothing is allocated after model_load()
+_Alignas(32) uint8_t model_blob[MODEL_MAX_BYTES];
+_Alignas(32) uint8_t model_arena[MODEL_ARENA_BYTES];
+model_layer_t model_layers[MODEL_MAX_LAYERS];
+int model_num_layers = 0;
+int model_in_h, model_in_w;
+float model_output_scale;
+int8_t *model_act[2];
+int8_t *model_scratch;
+uint8_t *model_frame;
+bool model_loaded = false;
+
+// Sensor trace record/replay
+trace_mode_t trace_mode = TRACE_OFF;
+FILE *trace_file;
+uint64_t trace_last_us;                 // Owned by the flush task once recording starts
+_Atomic uint32_t trace_dropped = 0;
+uint8_t *trace_data;
+size_t trace_size;
+trace_cursor_t trace_cursors[TRACE_ACTUATION + 1];
+uint64_t replay_now_us;
+int32_t last_actuation[NUM_ACTUATORS] = {-1, -1, -1, -1};
+trace_actuation_t *expected_actuations[NUM_ACTUATORS];
+size_t expected_count[NUM_ACTUATORS];
+size_t expected_next[NUM_ACTUATORS];
+uint32_t actuation_mismatches = 0;
+uint32_t *replay_latency_ns;
+size_t replay_cycles = 0;
+
+// Shorter period => higher priority (rate-monotonic order)
+rt_task_t tasks[] = {
+    {.name = "control",   .run = control_task,            .period_us = 1000000 / CONTROL_RATE_HZ, .cpu = CONTROL_CPU},
+    {.name = "cruise",    .run = adaptive_cruise_control, .period_us = CRUISE_PERIOD_US, .cpu = -1},
+    {.name = "obstacle",  .run = ai_obstacle_recognition, .period_us = 50000,    .cpu = INFERENCE_CPU, .replay_feed = TRACE_OBSTACLE},
+    {.name = "lane",      .run = lane_keeping_assist,     .period_us = 50000,    .cpu = -1, .replay_feed = TRACE_LANE},
+    {.name = "gps",       .run = update_gps_location,     .period_us = 1000000,  .cpu = -1, .replay_feed = TRACE_GPS},
+    {.name = "telemetry", .run = send_alerts,             .period_us = 1000000,  .cpu = -1, .live_only = true},
+    {.name = "trace",     .run = trace_flush,             .period_us = 1000000,  .cpu = -1, .live_only = true},
+    {.name = "stats",     .run = print_scheduler_stats,   .period_us = 10000000, .cpu = -1, .live_only = true},
+};
+#define NUM_TASKS (sizeof(tasks) / sizeof(tasks[0]))
+
+// Recording tasks never touch the file: each appends to its own single-producer
+// ring and trace_flush() merges them by time. The extra ring is for threads
+// outside the scheduler, which only write before it starts.
+trace_ring_t trace_rings[NUM_TASKS + 1];
+_Thread_local trace_ring_t *trace_ring_self;
+
+// Usage: collision                       live
+//        collision record <trace>        live, recording sensors and actuators
+//        collision replay <trace> [speed] drive the loop from a trace (speed 0 = max)
+int main(int argc, char **argv) {
+    if (argc >= 3 && strcmp(argv[1], "replay") == 0) {
+        if (!trace_load(argv[2])) {
+            return 1;
+        }
+        trace_mode = TRACE_REPLAY;
+        init_system();
+        return replay_trace(argc >= 4 ? atof(argv[3]) : 0.0);
+    }
+    if (argc >= 3 && strcmp(argv[1], "record") == 0) {
+        if (!trace_open(argv[2])) {
+            return 1;
+        }
+        trace_mode = TRACE_RECORD;
+    }
 
-int main() {
     init_system();
-    
-    while (1) {
-        read_sensors();
-        ai_obstacle_recognition();
-        control_vehicle();
-        update_gps_location();
-        adaptive_cruise_control();
-        lane_keeping_assist();
-        send_alerts();
-        sleep(1);  // Delay for 1 second
+    if (!start_scheduler()) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < NUM_TASKS; i++) {
+        pthread_join(tasks[i].thread, NULL);
     }
     return 0;
 }
 
 void init_system() {
     printf("Initializing Collision Avoidance System with GPS, Cruise Control, Lane Assist, and AI Obstacle Recognition...\n");
-    ultrasonic_init();
-    motor_init();
-    buzzer_init();
-    uart_init();
-    wifi_init();
-    gps_init();
-    cruise_control_init();
-    lane_assist_init();
-    ai_obstacle_init();
+    if (trace_mode != TRACE_REPLAY) {
+        ultrasonic_init();
+        motor_init();
+        buzzer_init();
+        uart_init();
+        wifi_init();
+        gps_init();
+        cruise_control_init();
+        lane_assist_init();
+        ai_obstacle_init();
+        model_loaded = model_load(MODEL_PATH);
+        if (!model_loaded) {
+            printf("[WARN] Falling back to the AI module's obstacle recognition.\n");
+        }
+    }
+    fusion_init();
+    telemetry_init();
+}
+
+void control_task() {
+    static uint64_t last_us;
+    struct timespec decision_start, start, end;
+    telemetry_record_t record;
+
+    clock_gettime(CLOCK_MONOTONIC, &decision_start);
+    read_sensors();
+    uint64_t now = now_us();
+    float dt = last_us ? (float)(now - last_us) * 1e-6f : 1.0f / CONTROL_RATE_HZ;
+    last_us = now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fusion_update(dt);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint32_t fusion_ns = (uint32_t)timespec_diff_ns(&end, &start);
+    if (fusion_ns > fusion_max_ns) {
+        fusion_max_ns = fusion_ns;
+    }
+    control_vehicle();
+    if (trace_mode == TRACE_REPLAY) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        replay_latency_ns[replay_cycles++] = (uint32_t)timespec_diff_ns(&end, &decision_start);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    record.timestamp_ms = monotonic_ms();
+    record.distance = distance;
+    record.speed = vehicle_speed;
+    record.flags = (emergency_brake ? TELEMETRY_FLAG_BRAKE : 0) | (lane_off_center ? TELEMETRY_FLAG_OFF_CENTER : 0)
+                 | (uint8_t)(obstacle_latest().cls << TELEMETRY_CLASS_SHIFT);
+    telemetry_enqueue(&record);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    uint32_t spent_ns = (uint32_t)timespec_diff_ns(&end, &start);
+    telemetry_enqueue_ns += spent_ns;
+    if (spent_ns > telemetry_enqueue_max_ns) {
+        telemetry_enqueue_max_ns = spent_ns;
+    }
 }
 
 void read_sensors() {
-    distance = read_ultrasonic_sensor();
-    printf("Obstacle Distance: %d cm\n", distance);
+    uint16_t ranges[NUM_ULTRASONIC];
+    if (trace_mode == TRACE_REPLAY) {
+        uint64_t t;
+        const uint8_t *payload = trace_next(TRACE_RANGES, &t, true);
+        memcpy(ranges, payload, sizeof(ranges));
+    } else {
+        for (int i = 0; i < NUM_ULTRASONIC; i++) {
+            ranges[i] = read_ultrasonic_channel(i);
+        }
+        if (trace_mode == TRACE_RECORD) {
+            trace_write(TRACE_RANGES, (const uint8_t *)ranges, sizeof(ranges));
+        }
+    }
+    for (int i = 0; i < NUM_ULTRASONIC; i++) {
+        kf_measured[i] = ranges[i];
+    }
+}
+
+void fusion_init() {
+    float ego_rate = -(float)vehicle_speed * (100000.0f / 3600.0f);
+    for (int i = 0; i < NUM_ULTRASONIC; i++) {
+        kf_range[i] = ULTRASONIC_MAX_RANGE;
+        kf_rate[i] = ego_rate;
+        kf_p00[i] = ULTRASONIC_MAX_RANGE * ULTRASONIC_MAX_RANGE;
+        kf_p01[i] = 0.0f;
+        kf_p11[i] = ego_rate * ego_rate;
+        kf_ttc[i] = TTC_NONE;
+        kf_misses[i] = FUSION_MAX_MISSES;
+    }
+}
+
+// Predict + update every sensor, then derive time-to-collision. A track that
+// loses its echo coasts on the prediction, so one dropped echo does not
+// release the brake; after FUSION_MAX_MISSES cycles it is re-seeded at max
+// range closing at ego speed (a stationary object ahead), so a newly
+// appearing obstacle starts with a sensible rate prior.
+void fusion_update(float dt) {
+    const float ego_rate = -(float)vehicle_speed * (100000.0f / 3600.0f);
+    const float q = ACCEL_NOISE * ACCEL_NOISE;
+    const float q00 = q * dt * dt * dt * dt * 0.25f;
+    const float q01 = q * dt * dt * dt * 0.5f;
+    const float q11 = q * dt * dt;
+    float nearest = ULTRASONIC_MAX_RANGE;
+    float ttc = TTC_NONE;
+    int i = 0;
+
+#ifdef __AVX2__
+    // Same arithmetic as the scalar loop below, with the per-sensor choices
+    // made by masks and blends instead of branches
+    const __m256 one = _mm256_set1_ps(1.0f), zero = _mm256_setzero_ps();
+    const __m256 max_range = _mm256_set1_ps(ULTRASONIC_MAX_RANGE), max_misses = _mm256_set1_ps(FUSION_MAX_MISSES);
+    const __m256 vdt = _mm256_set1_ps(dt), vego = _mm256_set1_ps(ego_rate);
+    __m256 nearest_v = max_range, ttc_v = _mm256_set1_ps(TTC_NONE);
+    for (; i + 8 <= NUM_ULTRASONIC; i += 8) {
+        __m256 z = _mm256_loadu_ps(kf_measured + i);
+        __m256 valid = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(z, zero, _CMP_GT_OQ), _mm256_cmp_ps(z, max_range, _CMP_LT_OQ)), one);
+        __m256 misses = _mm256_mul_ps(_mm256_sub_ps(one, valid), _mm256_add_ps(_mm256_loadu_ps(kf_misses + i), one));
+        misses = _mm256_min_ps(misses, max_misses);
+        __m256 coast = _mm256_and_ps(_mm256_sub_ps(one, valid), _mm256_cmp_ps(misses, max_misses, _CMP_LT_OQ));
+        __m256 reset = _mm256_sub_ps(_mm256_sub_ps(one, valid), coast);
+        __m256 keep = _mm256_sub_ps(one, reset);
+
+        __m256 rate = _mm256_loadu_ps(kf_rate + i);
+        __m256 p00 = _mm256_loadu_ps(kf_p00 + i), p01 = _mm256_loadu_ps(kf_p01 + i), p11 = _mm256_loadu_ps(kf_p11 + i);
+        __m256 r = _mm256_add_ps(_mm256_loadu_ps(kf_range + i), _mm256_mul_ps(vdt, rate));
+        __m256 v = rate;
+        p00 = _mm256_add_ps(_mm256_add_ps(p00, _mm256_mul_ps(vdt, _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), p01),
+                                                                               _mm256_mul_ps(vdt, p11)))), _mm256_set1_ps(q00));
+        p01 = _mm256_add_ps(_mm256_add_ps(p01, _mm256_mul_ps(vdt, p11)), _mm256_set1_ps(q01));
+        p11 = _mm256_add_ps(p11, _mm256_set1_ps(q11));
+
+        __m256 s = _mm256_add_ps(p00, _mm256_set1_ps(RANGE_NOISE_VAR));
+        __m256 k0 = _mm256_div_ps(_mm256_mul_ps(valid, p00), s);
+        __m256 k1 = _mm256_div_ps(_mm256_mul_ps(valid, p01), s);
+        __m256 y = _mm256_sub_ps(z, r);
+        r = _mm256_add_ps(r, _mm256_mul_ps(k0, y));
+        v = _mm256_add_ps(v, _mm256_mul_ps(k1, y));
+        p11 = _mm256_sub_ps(p11, _mm256_mul_ps(k1, p01));
+        p01 = _mm256_sub_ps(p01, _mm256_mul_ps(k0, p01));
+        p00 = _mm256_sub_ps(p00, _mm256_mul_ps(k0, p00));
+
+        r = _mm256_add_ps(_mm256_mul_ps(keep, r), _mm256_mul_ps(reset, max_range));
+        v = _mm256_add_ps(_mm256_mul_ps(keep, v), _mm256_mul_ps(reset, vego));
+        _mm256_storeu_ps(kf_range + i, r);
+        _mm256_storeu_ps(kf_rate + i, v);
+        _mm256_storeu_ps(kf_p00 + i, _mm256_add_ps(_mm256_mul_ps(keep, p00),
+                                                   _mm256_mul_ps(reset, _mm256_set1_ps(ULTRASONIC_MAX_RANGE * ULTRASONIC_MAX_RANGE))));
+        _mm256_storeu_ps(kf_p01 + i, _mm256_mul_ps(keep, p01));
+        _mm256_storeu_ps(kf_p11 + i, _mm256_add_ps(_mm256_mul_ps(keep, p11), _mm256_mul_ps(reset, _mm256_mul_ps(vego, vego))));
+        _mm256_storeu_ps(kf_misses + i, misses);
+
+        __m256 closing = _mm256_and_ps(_mm256_cmp_ps(reset, zero, _CMP_EQ_OQ), _mm256_cmp_ps(v, _mm256_set1_ps(-1.0f), _CMP_LT_OQ));
+        __m256 t = _mm256_div_ps(r, _mm256_sub_ps(zero, _mm256_min_ps(v, _mm256_set1_ps(-1.0f))));
+        t = _mm256_blendv_ps(_mm256_set1_ps(TTC_NONE), t, closing);
+        _mm256_storeu_ps(kf_ttc + i, t);
+        nearest_v = _mm256_min_ps(nearest_v, r);
+        ttc_v = _mm256_min_ps(ttc_v, t);
+    }
+    nearest = hmin_ps(nearest_v);
+    ttc = hmin_ps(ttc_v);
+#endif
+    for (; i < NUM_ULTRASONIC; i++) {
+        float z = kf_measured[i];
+        float valid = (z > 0.0f && z < ULTRASONIC_MAX_RANGE) ? 1.0f : 0.0f;
+        float misses = (1.0f - valid) * (kf_misses[i] + 1.0f);
+        misses = misses < FUSION_MAX_MISSES ? misses : FUSION_MAX_MISSES;
+        float coast = (1.0f - valid) * (misses < FUSION_MAX_MISSES ? 1.0f : 0.0f);
+        float reset = 1.0f - valid - coast;
+
+        float r = kf_range[i] + dt * kf_rate[i];
+        float v = kf_rate[i];
+        float p00 = kf_p00[i] + dt * (2.0f * kf_p01[i] + dt * kf_p11[i]) + q00;
+        float p01 = kf_p01[i] + dt * kf_p11[i] + q01;
+        float p11 = kf_p11[i] + q11;
+
+        // Correction is scaled by valid, so a coasting track keeps the prediction
+        float k0 = valid * p00 / (p00 + RANGE_NOISE_VAR);
+        float k1 = valid * p01 / (p00 + RANGE_NOISE_VAR);
+        float y = z - r;
+        r += k0 * y;
+        v += k1 * y;
+        p11 -= k1 * p01;
+        p01 -= k0 * p01;
+        p00 -= k0 * p00;
+
+        kf_range[i] = (1.0f - reset) * r + reset * ULTRASONIC_MAX_RANGE;
+        kf_rate[i] = (1.0f - reset) * v + reset * ego_rate;
+        kf_p00[i] = (1.0f - reset) * p00 + reset * (ULTRASONIC_MAX_RANGE * ULTRASONIC_MAX_RANGE);
+        kf_p01[i] = (1.0f - reset) * p01;
+        kf_p11[i] = (1.0f - reset) * p11 + reset * (ego_rate * ego_rate);
+        kf_misses[i] = misses;
+        // Divide by a safe closing rate, then select
+        float t = kf_range[i] / -fminf(kf_rate[i], -1.0f);
+        kf_ttc[i] = (reset == 0.0f && kf_rate[i] < -1.0f) ? t : TTC_NONE;
+        nearest = kf_range[i] < nearest ? kf_range[i] : nearest;
+        ttc = kf_ttc[i] < ttc ? kf_ttc[i] : ttc;
+    }
+    distance = nearest > 0.0f ? (uint16_t)nearest : 0;
+    min_ttc = ttc;
+}
+
+#ifdef __AVX2__
+float hmin_ps(__m256 v) {
+    __m128 m = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    m = _mm_min_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
 }
+#endif
 
 void ai_obstacle_recognition() {
-    recognize_obstacle(detected_object);
-    printf("AI Detected Object: %s\n", detected_object);
+    obstacle_class_t cls = OBSTACLE_NONE;
+    float confidence = 0.0f;
+    struct timespec start, end;
+
+    if (trace_mode == TRACE_REPLAY) {
+        uint64_t t;
+        const uint8_t *payload = trace_next(TRACE_OBSTACLE, &t, true);
+        if (payload) {
+            obstacle_publish((obstacle_class_t)payload[0], payload[1] / 255.0f);
+        }
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (model_loaded) {
+        camera_capture_frame(model_frame, model_in_w, model_in_h);
+        confidence = model_run(&cls);
+    } else {
+        char object[30];
+        recognize_obstacle(object);
+        cls = obstacle_class_from_name(object);
+        confidence = 1.0f;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    uint32_t spent_us = (uint32_t)(timespec_diff_ns(&end, &start) / 1000);
+    if (spent_us > inference_max_us) {
+        inference_max_us = spent_us;
+    }
+    obstacle_publish(cls, confidence);
+    if (trace_mode == TRACE_RECORD) {
+        uint8_t payload[2] = {(uint8_t)cls, (uint8_t)(confidence * 255.0f + 0.5f)};
+        trace_write(TRACE_OBSTACLE, payload, sizeof(payload));
+    }
+}
+
+obstacle_class_t obstacle_class_from_name(const char *name) {
+    for (int i = 0; i < NUM_OBSTACLE_CLASSES; i++) {
+        if (strcmp(name, obstacle_names[i]) == 0) {
+            return (obstacle_class_t)i;
+        }
+    }
+    return OBSTACLE_NONE;
+}
+
+// Seqlock writer: only the inference task publishes
+void obstacle_publish(obstacle_class_t cls, float confidence) {
+    uint32_t seq = atomic_load_explicit(&obstacle_seq, memory_order_relaxed);
+    atomic_store_explicit(&obstacle_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&obstacle_class_pub, (uint8_t)cls, memory_order_relaxed);
+    atomic_store_explicit(&obstacle_confidence_pub, confidence, memory_order_relaxed);
+    atomic_store_explicit(&obstacle_stamp_pub, monotonic_ms(), memory_order_relaxed);
+    atomic_store_explicit(&obstacle_seq, seq + 2, memory_order_release);
+}
+
+// Seqlock reader: never blocks the writer, retries only if it raced a publish
+obstacle_result_t obstacle_latest() {
+    obstacle_result_t result;
+    uint32_t begin, end;
+    do {
+        begin = atomic_load_explicit(&obstacle_seq, memory_order_acquire);
+        result.cls = (obstacle_class_t)atomic_load_explicit(&obstacle_class_pub, memory_order_relaxed);
+        result.confidence = atomic_load_explicit(&obstacle_confidence_pub, memory_order_relaxed);
+        result.timestamp_ms = atomic_load_explicit(&obstacle_stamp_pub, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        end = atomic_load_explicit(&obstacle_seq, memory_order_relaxed);
+    } while ((begin & 1) || begin != end);
+    return result;
+}
+
+// Model file (little endian):
+//   "QNN1", u16 in_h, u16 in_w, u16 in_c, u16 num_layers, f32 output_scale
+//   per layer: u8 type, u8 stride, u8 relu, u8 shift, u16 out_c, u16 reserved,
+//              i32 multiplier, then for conv/dense i32 bias[out_c] and
+//              i8 weights[out_c][k] padded to 4 bytes
+// Conv weights are [out_c][3][3][in_c]; activations are int8 HWC with zero
+// point 0 and are requantized as acc * multiplier >> (31 + shift).
+bool model_load(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    size_t size = fread(model_blob, 1, sizeof(model_blob), file);
+    bool truncated = !feof(file);
+    fclose(file);
+    if (truncated || size < 16 || memcmp(model_blob, "QNN1", 4) != 0) {
+        printf("[WARN] %s is not a usable model file.\n", path);
+        return false;
+    }
+
+    const uint8_t *p = model_blob + 4;
+    const uint8_t *limit = model_blob + size;
+    uint16_t h, w, c, layers;
+    memcpy(&h, p, 2);
+    memcpy(&w, p + 2, 2);
+    memcpy(&c, p + 4, 2);
+    memcpy(&layers, p + 6, 2);
+    memcpy(&model_output_scale, p + 8, 4);
+    p += 12;
+    if (layers == 0 || layers > MODEL_MAX_LAYERS) {
+        return false;
+    }
+    model_in_h = h;
+    model_in_w = w;
+
+    // Walk the layers once to resolve shapes and size the arena: two ping-pong
+    // activation buffers plus one im2col row of scratch, all fixed from here on
+    size_t max_act = (size_t)h * w * c, max_scratch = 0;
+    for (int i = 0; i < layers; i++) {
+        model_layer_t *layer = &model_layers[i];
+        if (p + 12 > limit) {
+            return false;
+        }
+        layer->type = p[0];
+        layer->stride = p[1] ? p[1] : 1;
+        layer->relu = p[2];
+        layer->shift = p[3];
+        if (layer->shift > MODEL_MAX_SHIFT) {
+            return false;
+        }
+        memcpy(&layer->out_c, p + 4, 2);
+        memcpy(&layer->multiplier, p + 8, 4);
+        p += 12;
+        layer->in_h = h;
+        layer->in_w = w;
+        layer->in_c = c;
+
+        size_t k = 0;
+        if (layer->type == LAYER_CONV3X3) {
+            layer->out_h = (h - 1) / layer->stride + 1;
+            layer->out_w = (w - 1) / layer->stride + 1;
+            k = 9 * (size_t)c;
+            if (k * layer->out_w > max_scratch) {
+                max_scratch = k * layer->out_w;
+            }
+        } else if (layer->type == LAYER_MAXPOOL2) {
+            layer->out_h = h / 2;
+            layer->out_w = w / 2;
+            layer->out_c = c;
+        } else if (layer->type == LAYER_DENSE) {
+            layer->out_h = 1;
+            layer->out_w = 1;
+            k = (size_t)h * w * c;
+        } else {
+            return false;
+        }
+        if (k) {
+            size_t weight_bytes = ((size_t)layer->out_c * k + 3) & ~(size_t)3;
+            if (p + 4 * layer->out_c + weight_bytes > limit) {
+                return false;
+            }
+            layer->bias = (const int32_t *)p;
+            layer->weights = (const int8_t *)(p + 4 * layer->out_c);
+            p += 4 * layer->out_c + weight_bytes;
+        }
+        h = layer->out_h;
+        w = layer->out_w;
+        c = layer->out_c;
+        if ((size_t)h * w * c > max_act) {
+            max_act = (size_t)h * w * c;
+        }
+    }
+    if (h != 1 || w != 1 || c != NUM_OBSTACLE_CLASSES || model_layers[layers - 1].type != LAYER_DENSE) {
+        printf("[WARN] Model output does not match the %d obstacle classes.\n", NUM_OBSTACLE_CLASSES);
+        return false;
+    }
+
+    max_act = (max_act + 31) & ~(size_t)31;
+    size_t frame_bytes = ((size_t)model_in_h * model_in_w * model_layers[0].in_c + 31) & ~(size_t)31;
+    if (2 * max_act + max_scratch + frame_bytes > sizeof(model_arena)) {
+        printf("[WARN] Model needs %zu bytes of arena, only %zu available.\n",
+               2 * max_act + max_scratch + frame_bytes, sizeof(model_arena));
+        return false;
+    }
+    model_act[0] = (int8_t *)model_arena;
+    model_act[1] = (int8_t *)model_arena + max_act;
+    model_scratch = (int8_t *)model_arena + 2 * max_act;
+    model_frame = model_arena + 2 * max_act + max_scratch;
+    model_num_layers = layers;
+    printf("Loaded obstacle model %s: %dx%d input, %d layers, %zu byte arena.\n",
+           path, model_in_w, model_in_h, layers, 2 * max_act + max_scratch + frame_bytes);
+    return true;
+}
+
+#ifdef __AVX2__
+int32_t dot_s8(const int8_t *a, const int8_t *b, int k) {
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 16 <= k; i += 16) {
+        __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(a + i)));
+        __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(b + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+    }
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_hadd_epi32(sum, sum);
+    sum = _mm_hadd_epi32(sum, sum);
+    int32_t total = _mm_cvtsi128_si32(sum);
+    for (; i < k; i++) {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+#else
+int32_t dot_s8(const int8_t *a, const int8_t *b, int k) {
+    int32_t total = 0;
+    for (int i = 0; i < k; i++) {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+#endif
+
+int8_t requantize(int32_t acc, const model_layer_t *layer) {
+    int total_shift = 31 + layer->shift;
+    int64_t v = ((int64_t)acc * layer->multiplier + (1LL << (total_shift - 1))) >> total_shift;
+    int64_t low = layer->relu ? 0 : -128;
+    return (int8_t)(v < low ? low : (v > 127 ? 127 : v));
+}
+
+// out[n][m] = requant(bias[m] + weights[m] . patches[n]) for n pixels, m channels
+void gemm_s8(const model_layer_t *layer, const int8_t *patches, int n, int k, int8_t *out, int32_t *raw) {
+    for (int j = 0; j < n; j++) {
+        for (int m = 0; m < layer->out_c; m++) {
+            int32_t acc = layer->bias[m] + dot_s8(layer->weights + (size_t)m * k, patches + (size_t)j * k, k);
+            out[(size_t)j * layer->out_c + m] = requantize(acc, layer);
+            if (raw) {
+                raw[m] = acc;
+            }
+        }
+    }
+}
+
+void conv3x3_s8(const model_layer_t *layer, const int8_t *in, int8_t *out) {
+    int k = 9 * layer->in_c;
+    for (int oy = 0; oy < layer->out_h; oy++) {
+        // im2col one output row, zero padding at the borders
+        for (int ox = 0; ox < layer->out_w; ox++) {
+            int8_t *patch = model_scratch + (size_t)ox * k;
+            for (int ky = 0; ky < 3; ky++) {
+                int iy = oy * layer->stride + ky - 1;
+                for (int kx = 0; kx < 3; kx++) {
+                    int ix = ox * layer->stride + kx - 1;
+                    int8_t *dst = patch + (ky * 3 + kx) * layer->in_c;
+                    if (iy < 0 || iy >= layer->in_h || ix < 0 || ix >= layer->in_w) {
+                        memset(dst, 0, layer->in_c);
+                    } else {
+                        memcpy(dst, in + ((size_t)iy * layer->in_w + ix) * layer->in_c, layer->in_c);
+                    }
+                }
+            }
+        }
+        gemm_s8(layer, model_scratch, layer->out_w, k, out + (size_t)oy * layer->out_w * layer->out_c, NULL);
+    }
+}
+
+void maxpool2_s8(const model_layer_t *layer, const int8_t *in, int8_t *out) {
+    int c = layer->in_c;
+    for (int oy = 0; oy < layer->out_h; oy++) {
+        for (int ox = 0; ox < layer->out_w; ox++) {
+            const int8_t *a = in + ((size_t)(2 * oy) * layer->in_w + 2 * ox) * c;
+            const int8_t *b = a + (size_t)layer->in_w * c;
+            int8_t *dst = out + ((size_t)oy * layer->out_w + ox) * c;
+            for (int ch = 0; ch < c; ch++) {
+                int8_t m0 = a[ch] > a[c + ch] ? a[ch] : a[c + ch];
+                int8_t m1 = b[ch] > b[c + ch] ? b[ch] : b[c + ch];
+                dst[ch] = m0 > m1 ? m0 : m1;
+            }
+        }
+    }
+}
+
+// Runs the loaded network on model_frame; returns the softmax confidence of the winning class
+float model_run(obstacle_class_t *cls) {
+    int32_t logits[NUM_OBSTACLE_CLASSES];
+    size_t pixels = (size_t)model_in_h * model_in_w * model_layers[0].in_c;
+    int8_t *in = model_act[0];
+
+    for (size_t i = 0; i < pixels; i++) {
+        in[i] = (int8_t)(model_frame[i] - 128);
+    }
+    for (int i = 0; i < model_num_layers; i++) {
+        const model_layer_t *layer = &model_layers[i];
+        int8_t *out = model_act[(i + 1) & 1];
+        if (layer->type == LAYER_CONV3X3) {
+            conv3x3_s8(layer, in, out);
+        } else if (layer->type == LAYER_MAXPOOL2) {
+            maxpool2_s8(layer, in, out);
+        } else {
+            gemm_s8(layer, in, 1, layer->in_h * layer->in_w * layer->in_c, out,
+                    i == model_num_layers - 1 ? logits : NULL);
+        }
+        in = out;
+    }
+
+    int best = 0;
+    for (int i = 1; i < NUM_OBSTACLE_CLASSES; i++) {
+        if (logits[i] > logits[best]) {
+            best = i;
+        }
+    }
+    float sum = 0.0f;
+    for (int i = 0; i < NUM_OBSTACLE_CLASSES; i++) {
+        sum += expf((float)(logits[i] - logits[best]) * model_output_scale);
+    }
+    *cls = (obstacle_class_t)best;
+    return 1.0f / sum;
 }
 
 void control_vehicle() {
-    emergency_brake = false;
-    if (distance < SAFE_DISTANCE) {
-        motor_stop();
-        buzzer_on();
-        emergency_brake = true;
-        printf("[ALERT] Obstacle detected! Stopping vehicle.\n");
+    obstacle_result_t obstacle = obstacle_latest();
+    float brake_ttc = TTC_BRAKE_S;
+    if ((obstacle.cls == OBSTACLE_PEDESTRIAN || obstacle.cls == OBSTACLE_CYCLIST)
+        && obstacle.confidence >= OBSTACLE_MIN_CONFIDENCE) {
+        brake_ttc *= VULNERABLE_TTC_FACTOR;
+    }
+    bool brake = min_ttc < brake_ttc || distance < SAFE_DISTANCE;
+    if (brake) {
+        actuate(ACT_MOTOR, MOTOR_STOP);
+        actuate(ACT_BUZZER, 1);
+        if (!emergency_brake) {
+            printf("[ALERT] Obstacle detected! Stopping vehicle.\n");
+        }
     } else {
-        motor_forward();
-        buzzer_off();
+        actuate(ACT_MOTOR, MOTOR_FORWARD);
+        actuate(ACT_BUZZER, 0);
     }
+    emergency_brake = brake;
 }
 
 void update_gps_location() {
-    get_gps_location(gps_location);
-    printf("Current GPS Location: %s\n", gps_location);
+    char location[sizeof(gps_location)];
+    if (trace_mode == TRACE_REPLAY) {
+        if (!trace_read_string(TRACE_GPS, location, sizeof(location))) {
+            return;
+        }
+    } else {
+        get_gps_location(location);
+        if (trace_mode == TRACE_RECORD) {
+            trace_write_string(TRACE_GPS, location);
+        }
+    }
+    pthread_mutex_lock(&state_lock);
+    strcpy(gps_location, location);
+    pthread_mutex_unlock(&state_lock);
+    printf("Current GPS Location: %s\n", location);
 }
 
 void adaptive_cruise_control() {
-    if (distance < SAFE_DISTANCE + 20) { // Adjust speed based on nearby objects
-        vehicle_speed -= 10;
-    } else if (vehicle_speed < 50) {
-        vehicle_speed += 5;
+    const float dt_s = CRUISE_PERIOD_US / 1e6f;
+    float speed = cruise_speed;
+    if (min_ttc < TTC_SLOW_S || distance < SAFE_DISTANCE + 20) { // Adjust speed based on nearby objects
+        speed -= CRUISE_DECEL_KMH_S * dt_s;
+    } else {
+        speed += CRUISE_ACCEL_KMH_S * dt_s;
     }
-    set_vehicle_speed(vehicle_speed);
-    printf("Adaptive Cruise Control - Speed: %d km/h\n", vehicle_speed);
+    if (speed < 0.0f) {
+        speed = 0.0f;
+    } else if (speed > CRUISE_SPEED_MAX) {
+        speed = CRUISE_SPEED_MAX;
+    }
+    cruise_speed = speed;
+    vehicle_speed = (uint8_t)(speed + 0.5f);
+    actuate(ACT_SPEED, (int16_t)vehicle_speed);
 }
 
 void lane_keeping_assist() {
-    detect_lane_position(lane_status);
-    printf("Lane Status: %s\n", lane_status);
-    if (strcmp(lane_status, "Off-Center") == 0) {
-        correct_lane_position();
+    char status[sizeof(lane_status)];
+    if (trace_mode == TRACE_REPLAY) {
+        if (!trace_read_string(TRACE_LANE, status, sizeof(status))) {
+            return;
+        }
+    } else {
+        detect_lane_position(status);
+        if (trace_mode == TRACE_RECORD) {
+            trace_write_string(TRACE_LANE, status);
+        }
+    }
+    pthread_mutex_lock(&state_lock);
+    strcpy(lane_status, status);
+    pthread_mutex_unlock(&state_lock);
+    lane_off_center = strcmp(status, "Off-Center") == 0;
+    if (lane_off_center) {
+        actuate(ACT_LANE_CORRECT, 1);
     }
 }
 
+// Runs on the telemetry task: drains what the control loop queued since the
+// last cycle and uploads it as one batch, spooling to disk if the link is down
 void send_alerts() {
+    static telemetry_record_t batch[TELEMETRY_BATCH_MAX];
+    static uint8_t encoded[TELEMETRY_BATCH_MAX * 16];
+    static char body[TELEMETRY_BATCH_MAX * 24 + 256];
     char log_data[200];
-    sprintf(log_data, "Distance: %d cm, Brake: %d, Speed: %d km/h, Location: %s, Object: %s, Lane: %s", distance, emergency_brake, vehicle_speed, gps_location, detected_object, lane_status);
+    size_t count = 0;
+
+    while (count < TELEMETRY_BATCH_MAX && telemetry_dequeue(&batch[count])) {
+        count++;
+    }
+    if (count == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&state_lock);
+    int header = sprintf(body, "{\"loc\":\"%s\",\"obj\":\"%s\",\"lane\":\"%s\",\"batch\":\"", gps_location, obstacle_names[obstacle_latest().cls], lane_status);
+    pthread_mutex_unlock(&state_lock);
+    size_t encoded_len = telemetry_encode_batch(batch, count, encoded);
+    size_t body_len = header + base64_encode(encoded, encoded_len, body + header);
+    strcpy(body + body_len, "\"}");
+
+    const telemetry_record_t *last = &batch[count - 1];
+    sprintf(log_data, "Distance: %d cm, Brake: %d, Speed: %d km/h, Records: %zu, Encoded: %zu bytes",
+            last->distance, (last->flags & TELEMETRY_FLAG_BRAKE) != 0, last->speed, count, encoded_len);
     uart_send(log_data);
-    wifi_send_data("http://vehicle-alerts.com/api/logs", log_data);
+
+    if (telemetry_post(body)) {
+        telemetry_batches_sent++;
+        telemetry_replay_spool();
+    } else {
+        telemetry_spool(body);
+    }
     printf("Data sent to monitoring system: %s\n", log_data);
 }
+
+void telemetry_init() {
+    for (uint32_t i = 0; i < TELEMETRY_QUEUE_SIZE; i++) {
+        telemetry_queue[i].sequence = i;
+    }
+    FILE *spool = fopen(TELEMETRY_SPOOL_PATH, "rb");
+    if (spool) {
+        fseek(spool, 0, SEEK_END);
+        telemetry_spool_bytes = ftell(spool);
+        fclose(spool);
+    }
+#ifdef TELEMETRY_STANDIN_SERVER
+    pthread_t server;
+    if (pthread_create(&server, NULL, standin_server_thread, NULL) == 0) {
+        pthread_detach(server);
+    } else {
+        printf("[WARN] Telemetry stand-in server not started, batches will be spooled.\n");
+    }
+#endif
+}
+
+// Never blocks: when the sender falls behind the newest record is dropped
+bool telemetry_enqueue(const telemetry_record_t *record) {
+    uint32_t pos = atomic_load_explicit(&telemetry_head, memory_order_relaxed);
+    while (1) {
+        telemetry_cell_t *cell = &telemetry_queue[pos & (TELEMETRY_QUEUE_SIZE - 1)];
+        uint32_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&telemetry_head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                cell->record = *record;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&telemetry_dropped, 1, memory_order_relaxed);
+            return false;
+        } else {
+            pos = atomic_load_explicit(&telemetry_head, memory_order_relaxed);
+        }
+    }
+}
+
+bool telemetry_dequeue(telemetry_record_t *record) {
+    telemetry_cell_t *cell = &telemetry_queue[telemetry_tail & (TELEMETRY_QUEUE_SIZE - 1)];
+    uint32_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    if (seq != telemetry_tail + 1) {
+        return false;
+    }
+    *record = cell->record;
+    atomic_store_explicit(&cell->sequence, telemetry_tail + TELEMETRY_QUEUE_SIZE, memory_order_release);
+    telemetry_tail++;
+    return true;
+}
+
+uint8_t *put_uvarint(uint8_t *p, uint64_t value) {
+    while (value >= 0x80) {
+        *p++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+uint8_t *put_varint(uint8_t *p, int32_t value) {
+    return put_uvarint(p, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+// Batch layout: "CT" v1, u16 count, then per record the zigzag varint delta of
+// every field against the previous record. Consecutive cycles rarely change, so
+// the deltas are mostly 0x00 bytes, which are run-length coded as 0x00 <run>.
+size_t telemetry_encode_batch(const telemetry_record_t *records, size_t count, uint8_t *out) {
+    static uint8_t raw[TELEMETRY_BATCH_MAX * 16];
+    telemetry_record_t prev = {0};
+    uint8_t *p = raw;
+
+    for (size_t i = 0; i < count; i++) {
+        p = put_varint(p, (int32_t)(records[i].timestamp_ms - prev.timestamp_ms));
+        p = put_varint(p, records[i].distance - prev.distance);
+        p = put_varint(p, records[i].speed - prev.speed);
+        p = put_varint(p, records[i].flags - prev.flags);
+        prev = records[i];
+    }
+
+    size_t n = 0;
+    out[n++] = 'C';
+    out[n++] = 'T';
+    out[n++] = 1;
+    out[n++] = (uint8_t)(count >> 8);
+    out[n++] = (uint8_t)count;
+    for (uint8_t *q = raw; q < p;) {
+        if (*q != 0) {
+            out[n++] = *q++;
+            continue;
+        }
+        uint8_t run = 0;
+        while (q < p && *q == 0 && run < 255) {
+            q++;
+            run++;
+        }
+        out[n++] = 0;
+        out[n++] = run;
+    }
+    return n;
+}
+
+size_t base64_encode(const uint8_t *in, size_t len, char *out) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t n = 0;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)in[i] << 16;
+        if (i + 1 < len) v |= (uint32_t)in[i + 1] << 8;
+        if (i + 2 < len) v |= in[i + 2];
+        out[n++] = table[(v >> 18) & 63];
+        out[n++] = table[(v >> 12) & 63];
+        out[n++] = i + 1 < len ? table[(v >> 6) & 63] : '=';
+        out[n++] = i + 2 < len ? table[v & 63] : '=';
+    }
+    out[n] = '\0';
+    return n;
+}
+
+// Spool entries are length-prefixed bodies appended in upload order
+void telemetry_spool(const char *body) {
+    uint32_t len = (uint32_t)strlen(body);
+    if (telemetry_spool_bytes + (long)sizeof(len) + len > TELEMETRY_SPOOL_MAX) {
+        telemetry_batches_lost++;
+        return;
+    }
+    FILE *spool = fopen(TELEMETRY_SPOOL_PATH, "ab");
+    if (!spool) {
+        telemetry_batches_lost++;
+        return;
+    }
+    fwrite(&len, sizeof(len), 1, spool);
+    fwrite(body, 1, len, spool);
+    fclose(spool);
+    telemetry_spool_bytes += sizeof(len) + len;
+    telemetry_batches_spooled++;
+}
+
+void telemetry_replay_spool() {
+    static char body[TELEMETRY_BATCH_MAX * 24 + 256];
+    if (telemetry_spool_bytes == 0) {
+        return;
+    }
+    FILE *spool = fopen(TELEMETRY_SPOOL_PATH, "rb");
+    if (!spool) {
+        telemetry_spool_bytes = 0;
+        return;
+    }
+    uint32_t len;
+    long sent_upto = 0;
+    while (fread(&len, sizeof(len), 1, spool) == 1) {
+        // An oversized length or a body cut short by a crash mid-append can
+        // never be sent; drop it (and for a bad length, everything after it
+        // since the framing is lost) instead of blocking the spool forever
+        if (len >= sizeof(body) || fread(body, 1, len, spool) != len) {
+            telemetry_batches_lost++;
+            fseek(spool, 0, SEEK_END);
+            sent_upto = ftell(spool);
+            break;
+        }
+        body[len] = '\0';
+        if (!telemetry_post(body)) {
+            break;
+        }
+        telemetry_batches_sent++;
+        sent_upto = ftell(spool);
+    }
+
+    // Keep whatever the link refused for the next attempt
+    FILE *rest = fopen(TELEMETRY_SPOOL_PATH ".tmp", "wb");
+    long remaining = 0;
+    if (rest) {
+        size_t n;
+        fseek(spool, sent_upto, SEEK_SET);
+        while ((n = fread(body, 1, sizeof(body), spool)) > 0) {
+            fwrite(body, 1, n, rest);
+            remaining += (long)n;
+        }
+        fclose(rest);
+        rename(TELEMETRY_SPOOL_PATH ".tmp", TELEMETRY_SPOOL_PATH);
+    }
+    fclose(spool);
+    telemetry_spool_bytes = rest ? remaining : telemetry_spool_bytes;
+}
+
+#ifdef TELEMETRY_STANDIN_SERVER
+// Minimal HTTP endpoint on localhost so the pipeline can be exercised without
+// the Wi-Fi module; set TELEMETRY_STANDIN_FAIL=1 in the environment to make it
+// refuse uploads and drive the spool path.
+_Atomic uint64_t standin_bytes_received = 0;
+
+void *standin_server_thread(void *arg) {
+    (void)arg;
+    static char request[TELEMETRY_BATCH_MAX * 24 + 1024];
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(TELEMETRY_STANDIN_PORT) };
+    int one = 1;
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 8) != 0) {
+        printf("[WARN] Telemetry stand-in server could not listen on port %d.\n", TELEMETRY_STANDIN_PORT);
+        return NULL;
+    }
+    while (1) {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0) {
+            continue;
+        }
+        size_t got = 0;
+        long content_length = 0;
+        char *body = NULL;
+        ssize_t n;
+        while (got < sizeof(request) - 1 && (n = read(client, request + got, sizeof(request) - 1 - got)) > 0) {
+            got += (size_t)n;
+            request[got] = '\0';
+            if (!body && (body = strstr(request, "\r\n\r\n")) != NULL) {
+                body += 4;
+                char *cl = strstr(request, "Content-Length:");
+                content_length = cl ? strtol(cl + 15, NULL, 10) : 0;
+            }
+            if (body && (long)(request + got - body) >= content_length) {
+                break;
+            }
+        }
+        standin_bytes_received += got;
+        const char *status = getenv("TELEMETRY_STANDIN_FAIL") ? "503 Service Unavailable" : "200 OK";
+        dprintf(client, "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+        close(client);
+    }
+    return NULL;
+}
+
+bool telemetry_post(const char *body) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(TELEMETRY_STANDIN_PORT) };
+    char response[64] = {0};
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    bool ok = false;
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        dprintf(sock, "POST /api/logs HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n%s",
+                strlen(body), body);
+        ok = read(sock, response, sizeof(response) - 1) > 0 && strncmp(response, "HTTP/1.1 200", 12) == 0;
+    }
+    close(sock);
+    return ok;
+}
+#else
+// wifi_send_data() reports whether the upload was accepted
+bool telemetry_post(const char *body) {
+    return wifi_send_data(TELEMETRY_URL, body);
+}
+#endif
+
+// Time base for the control logic: the monotonic clock when live, the trace's
+// virtual clock during replay
+uint64_t now_us() {
+    if (trace_mode == TRACE_REPLAY) {
+        return replay_now_us;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Actuator commands funnel through here so they can be traced and diffed.
+// Only transitions are traced; lane correction is a one-shot command.
+void actuate(actuator_t actuator, int16_t value) {
+    if (trace_mode != TRACE_REPLAY) {
+        switch (actuator) {
+        case ACT_MOTOR:
+            if (value == MOTOR_FORWARD) {
+                motor_forward();
+            } else {
+                motor_stop();
+            }
+            break;
+        case ACT_BUZZER:
+            if (value) {
+                buzzer_on();
+            } else {
+                buzzer_off();
+            }
+            break;
+        case ACT_SPEED:
+            set_vehicle_speed((uint8_t)value);
+            break;
+        default:
+            correct_lane_position();
+            break;
+        }
+    }
+    if (actuator != ACT_LANE_CORRECT && last_actuation[actuator] == value) {
+        return;
+    }
+    last_actuation[actuator] = value;
+
+    if (trace_mode == TRACE_RECORD) {
+        uint8_t payload[3] = {(uint8_t)actuator, (uint8_t)value, (uint8_t)((uint16_t)value >> 8)};
+        trace_write(TRACE_ACTUATION, payload, sizeof(payload));
+    } else if (trace_mode == TRACE_REPLAY) {
+        trace_check_actuation(actuator, value);
+    }
+}
+
+// Trace file: "CTR1", u16 NUM_ULTRASONIC, u16 CONTROL_RATE_HZ, then records of
+// u8 type, uvarint microseconds since the previous record, and a payload:
+//   TRACE_RANGES     u16 range[NUM_ULTRASONIC]
+//   TRACE_GPS/LANE   u8 length + characters
+//   TRACE_OBSTACLE   u8 class, u8 confidence * 255
+//   TRACE_ACTUATION  u8 actuator, i16 value
+bool trace_open(const char *path) {
+    trace_file = fopen(path, "wb");
+    if (!trace_file) {
+        printf("[ERROR] Cannot create trace %s.\n", path);
+        return false;
+    }
+    uint16_t header[2] = {NUM_ULTRASONIC, CONTROL_RATE_HZ};
+    fwrite("CTR1", 1, 4, trace_file);
+    fwrite(header, sizeof(header), 1, trace_file);
+    trace_last_us = now_us();
+    return true;
+}
+
+void trace_ring_put(trace_ring_t *ring, uint32_t pos, const void *bytes, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        ring->data[(pos + i) & (TRACE_RING_BYTES - 1)] = ((const uint8_t *)bytes)[i];
+    }
+}
+
+void trace_ring_get(const trace_ring_t *ring, uint32_t pos, void *bytes, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        ((uint8_t *)bytes)[i] = ring->data[(pos + i) & (TRACE_RING_BYTES - 1)];
+    }
+}
+
+// Ring record: u64 time, u8 type, u16 length, payload. Never blocks; a full
+// ring drops the record and counts it.
+void trace_write(trace_type_t type, const uint8_t *payload, size_t len) {
+    trace_ring_t *ring = trace_ring_self ? trace_ring_self : &trace_rings[NUM_TASKS];
+    uint8_t head[11];
+    uint64_t now = now_us();
+    uint16_t length = (uint16_t)len;
+    uint32_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if (TRACE_RING_BYTES - (pos - atomic_load_explicit(&ring->tail, memory_order_acquire)) < sizeof(head) + len) {
+        trace_dropped++;
+        return;
+    }
+    memcpy(head, &now, 8);
+    head[8] = (uint8_t)type;
+    memcpy(head + 9, &length, 2);
+    trace_ring_put(ring, pos, head, sizeof(head));
+    trace_ring_put(ring, pos + sizeof(head), payload, len);
+    atomic_store_explicit(&ring->head, pos + (uint32_t)(sizeof(head) + len), memory_order_release);
+}
+
+void trace_write_string(trace_type_t type, const char *text) {
+    uint8_t payload[256];
+    size_t len = strlen(text);
+    len = len > 255 ? 255 : len;
+    payload[0] = (uint8_t)len;
+    memcpy(payload + 1, text, len);
+    trace_write(type, payload, len + 1);
+}
+
+// Merges the task rings into the file in time order. Only records older than
+// TRACE_FLUSH_LAG_US are taken, so a task stamped just before publishing is
+// not overtaken; one delayed past that is written at the previous record's time.
+void trace_flush() {
+    uint32_t heads[NUM_TASKS + 1];
+    uint8_t payload[256];
+
+    if (trace_mode != TRACE_RECORD) {
+        return;
+    }
+    uint64_t now = now_us();
+    uint64_t watermark = now > TRACE_FLUSH_LAG_US ? now - TRACE_FLUSH_LAG_US : 0;
+    for (size_t r = 0; r <= NUM_TASKS; r++) {
+        heads[r] = atomic_load_explicit(&trace_rings[r].head, memory_order_acquire);
+    }
+    for (;;) {
+        trace_ring_t *next = NULL;
+        uint64_t next_t = watermark;
+        for (size_t r = 0; r <= NUM_TASKS; r++) {
+            uint32_t tail = atomic_load_explicit(&trace_rings[r].tail, memory_order_relaxed);
+            uint64_t t;
+            if (tail == heads[r]) {
+                continue;
+            }
+            trace_ring_get(&trace_rings[r], tail, &t, 8);
+            if (t <= next_t) {
+                next = &trace_rings[r];
+                next_t = t;
+            }
+        }
+        if (!next) {
+            break;
+        }
+        uint32_t tail = atomic_load_explicit(&next->tail, memory_order_relaxed);
+        uint8_t head[11];
+        uint16_t length;
+        trace_ring_get(next, tail, head, sizeof(head));
+        memcpy(&length, head + 9, 2);
+        trace_ring_get(next, tail + sizeof(head), payload, length);
+        atomic_store_explicit(&next->tail, tail + (uint32_t)(sizeof(head) + length), memory_order_release);
+
+        uint8_t record[1 + 10];
+        uint64_t t = next_t > trace_last_us ? next_t : trace_last_us;
+        record[0] = head[8];
+        uint8_t *end = put_uvarint(record + 1, t - trace_last_us);
+        trace_last_us = t;
+        fwrite(record, 1, (size_t)(end - record), trace_file);
+        fwrite(payload, 1, length, trace_file);
+    }
+    fflush(trace_file);
+}
+
+size_t trace_payload_len(uint8_t type, const uint8_t *payload) {
+    switch (type) {
+    case TRACE_RANGES:
+        return 2 * NUM_ULTRASONIC;
+    case TRACE_GPS:
+    case TRACE_LANE:
+        return 1 + (size_t)payload[0];
+    case TRACE_OBSTACLE:
+        return 2;
+    case TRACE_ACTUATION:
+        return 3;
+    default:
+        return SIZE_MAX;
+    }
+}
+
+// Decodes the record at pos; returns the offset of the next one, 0 at the end
+size_t trace_parse(size_t pos, uint8_t *type, uint64_t *t_us, const uint8_t **payload) {
+    if (pos >= trace_size) {
+        return 0;
+    }
+    *type = trace_data[pos++];
+    uint64_t delta = 0;
+    for (int shift = 0; pos < trace_size; shift += 7) {
+        uint8_t byte = trace_data[pos++];
+        delta |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    *t_us += delta;
+    *payload = trace_data + pos;
+    size_t len = pos < trace_size ? trace_payload_len(*type, *payload) : SIZE_MAX;
+    if (len > trace_size - pos) {
+        return 0;
+    }
+    return pos + len;
+}
+
+// Each record type has its own cursor, so every consumer reads its samples in
+// the order they were produced regardless of how tasks interleave on replay.
+// A record is only consumed once the virtual clock has reached it.
+const uint8_t *trace_next(trace_type_t type, uint64_t *t_us, bool consume) {
+    trace_cursor_t *cursor = &trace_cursors[type];
+    size_t pos = cursor->pos;
+    uint64_t t = cursor->t_us;
+    uint8_t record_type;
+    const uint8_t *payload;
+    size_t next;
+
+    while ((next = trace_parse(pos, &record_type, &t, &payload)) != 0) {
+        if (record_type == type) {
+            if (consume && t > replay_now_us) {
+                return NULL;
+            }
+            if (consume) {
+                cursor->pos = next;
+                cursor->t_us = t;
+            }
+            *t_us = t;
+            return payload;
+        }
+        pos = next;
+    }
+    return NULL;
+}
+
+bool trace_read_string(trace_type_t type, char *out, size_t size) {
+    uint64_t t;
+    const uint8_t *payload = trace_next(type, &t, true);
+    if (!payload) {
+        return false;
+    }
+    size_t len = payload[0] < size - 1 ? payload[0] : size - 1;
+    memcpy(out, payload + 1, len);
+    out[len] = '\0';
+    return true;
+}
+
+bool trace_load(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        printf("[ERROR] Cannot open trace %s.\n", path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    trace_data = malloc(size > 0 ? (size_t)size : 1);
+    trace_size = trace_data ? fread(trace_data, 1, (size_t)size, file) : 0;
+    fclose(file);
+
+    uint16_t header[2];
+    if (trace_size < 8 || memcmp(trace_data, "CTR1", 4) != 0) {
+        printf("[ERROR] %s is not a collision avoidance trace.\n", path);
+        return false;
+    }
+    memcpy(header, trace_data + 4, sizeof(header));
+    if (header[0] != NUM_ULTRASONIC) {
+        printf("[ERROR] Trace has %d ultrasonic channels, this build has %d.\n", header[0], NUM_ULTRASONIC);
+        return false;
+    }
+    for (int i = 0; i <= TRACE_ACTUATION; i++) {
+        trace_cursors[i].pos = 8;
+    }
+
+    // Pre-pass: size the latency table and split recorded actuations per channel
+    size_t pos = 8, next;
+    uint64_t t = 0;
+    uint8_t type;
+    const uint8_t *payload;
+    size_t ranges = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (pos = 8, t = 0; (next = trace_parse(pos, &type, &t, &payload)) != 0; pos = next) {
+            if (type == TRACE_RANGES) {
+                ranges += pass == 0;
+            } else if (type == TRACE_ACTUATION && payload[0] < NUM_ACTUATORS) {
+                if (pass == 1) {
+                    trace_actuation_t *exp = &expected_actuations[payload[0]][expected_count[payload[0]]];
+                    exp->t_us = t;
+                    exp->value = (int16_t)(payload[1] | payload[2] << 8);
+                }
+                expected_count[payload[0]]++;
+            }
+        }
+        if (pass == 0) {
+            for (int i = 0; i < NUM_ACTUATORS; i++) {
+                expected_actuations[i] = calloc(expected_count[i] + 1, sizeof(trace_actuation_t));
+                expected_count[i] = 0;
+            }
+            replay_latency_ns = calloc(ranges + 1, sizeof(uint32_t));
+        }
+    }
+    if (pos != trace_size) {
+        printf("[WARN] Trace truncated after %zu of %zu bytes.\n", pos, trace_size);
+    }
+    printf("Loaded trace %s: %zu control cycles, %zu bytes.\n", path, ranges, trace_size);
+    return true;
+}
+
+void trace_check_actuation(actuator_t actuator, int16_t value) {
+    static const char *names[NUM_ACTUATORS] = {"motor", "buzzer", "speed", "lane-correct"};
+    const trace_actuation_t *exp = NULL;
+    int64_t skew = 0;
+
+    if (expected_next[actuator] < expected_count[actuator]) {
+        exp = &expected_actuations[actuator][expected_next[actuator]++];
+        skew = (int64_t)replay_now_us - (int64_t)exp->t_us;
+        if (exp->value == value && skew <= TRACE_DIFF_TOLERANCE_US && skew >= -TRACE_DIFF_TOLERANCE_US) {
+            return;
+        }
+    }
+    if (++actuation_mismatches <= 10) {
+        if (exp) {
+            printf("[DIFF] t=%.3f s %s: replay %d, recorded %d (skew %lld us)\n", replay_now_us * 1e-6,
+                   names[actuator], value, exp->value, (long long)skew);
+        } else {
+            printf("[DIFF] t=%.3f s %s: replay %d, not in recording\n", replay_now_us * 1e-6, names[actuator], value);
+        }
+    }
+}
+
+int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Drives the control loop from the trace on a virtual clock: one control cycle
+// per recorded range sample, trace-fed tasks once per record that is due (so
+// releases the live run skipped are skipped here too), other tasks whenever
+// their period has elapsed.
+// speed 1 replays in real time, 0 runs as fast as possible.
+int replay_trace(double speed) {
+    uint64_t release[NUM_TASKS];
+    uint64_t first = 0, t = 0;
+    struct timespec wall_start, wall_end;
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    while (trace_next(TRACE_RANGES, &t, false)) {
+        if (replay_cycles == 0) {
+            first = t;
+            for (size_t i = 0; i < NUM_TASKS; i++) {
+                release[i] = t + tasks[i].period_us;
+            }
+        }
+        replay_now_us = t;
+        if (speed > 0.0) {
+            // 64-bit ns: a uint32_t offset in us would wrap after ~71 minutes of trace
+            int64_t offset_ns = (int64_t)((double)(t - first) * 1000.0 / speed);
+            struct timespec due = wall_start;
+            due.tv_sec += offset_ns / 1000000000LL;
+            due.tv_nsec += offset_ns % 1000000000LL;
+            if (due.tv_nsec >= 1000000000L) {
+                due.tv_nsec -= 1000000000L;
+                due.tv_sec++;
+            }
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) != 0) {
+            }
+        }
+        control_task();
+        for (size_t i = 1; i < NUM_TASKS; i++) {
+            uint64_t due;
+            if (tasks[i].replay_feed) {
+                while (trace_next(tasks[i].replay_feed, &due, false) && due <= t) {
+                    tasks[i].run();
+                }
+                continue;
+            }
+            if (tasks[i].live_only || t < release[i]) {
+                continue;
+            }
+            tasks[i].run();
+            while (release[i] <= t) {
+                release[i] += tasks[i].period_us;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+
+    size_t missing = 0, recorded = 0;
+    for (int i = 0; i < NUM_ACTUATORS; i++) {
+        missing += expected_count[i] - expected_next[i];
+        recorded += expected_count[i];
+    }
+    double virtual_s = (t - first) * 1e-6;
+    double wall_s = timespec_diff_ns(&wall_end, &wall_start) * 1e-9;
+    printf("Replay - cycles: %zu, virtual: %.1f s, wall: %.3f s (%.0fx), actuations: %zu recorded, %u mismatched, %zu missing\n",
+           replay_cycles, virtual_s, wall_s, wall_s > 0.0 ? virtual_s / wall_s : 0.0,
+           recorded, actuation_mismatches, missing);
+    if (replay_cycles > 0) {
+        qsort(replay_latency_ns, replay_cycles, sizeof(uint32_t), compare_u32);
+        printf("Decision latency - p50: %u ns, p90: %u ns, p99: %u ns, p99.9: %u ns, max: %u ns\n",
+               replay_latency_ns[replay_cycles * 50 / 100], replay_latency_ns[replay_cycles * 90 / 100],
+               replay_latency_ns[replay_cycles * 99 / 100], replay_latency_ns[replay_cycles * 999 / 1000],
+               replay_latency_ns[replay_cycles - 1]);
+    }
+    return actuation_mismatches == 0 && missing == 0 ? 0 : 2;
+}
+
+uint32_t monotonic_ms() {
+    return (uint32_t)(now_us() / 1000);
+}
+
+int64_t timespec_diff_ns(const struct timespec *a, const struct timespec *b) {
+    return (int64_t)(a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+void timespec_add_us(struct timespec *t, uint32_t us) {
+    t->tv_nsec += (long)us * 1000;
+    while (t->tv_nsec >= 1000000000L) {
+        t->tv_nsec -= 1000000000L;
+        t->tv_sec++;
+    }
+}
+
+void record_jitter(rt_task_t *task, int64_t jitter_ns) {
+    uint32_t jitter_us = jitter_ns > 0 ? (uint32_t)(jitter_ns / 1000) : 0;
+    int bucket = 0;
+    while (bucket < JITTER_BUCKETS - 1 && (1u << bucket) <= jitter_us) {
+        bucket++;
+    }
+    task->jitter_hist[bucket]++;
+    if (jitter_us > task->max_jitter_us) {
+        task->max_jitter_us = jitter_us;
+    }
+}
+
+// Periodic release on absolute deadlines; a late task never drifts the schedule
+void *task_thread(void *arg) {
+    rt_task_t *task = arg;
+    struct timespec release, start, end;
+    int64_t period_ns = (int64_t)task->period_us * 1000;
+
+    trace_ring_self = &trace_rings[task - tasks];
+    clock_gettime(CLOCK_MONOTONIC, &release);
+    while (scheduler_running) {
+        timespec_add_us(&release, task->period_us);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &release, NULL) != 0) {
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        task->run();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        record_jitter(task, timespec_diff_ns(&start, &release));
+        task->runs++;
+        if (timespec_diff_ns(&end, &release) > period_ns) {
+            task->deadline_misses++;
+            // Skip the releases we overran instead of bursting to catch up
+            while (timespec_diff_ns(&end, &release) > period_ns) {
+                timespec_add_us(&release, task->period_us);
+            }
+        }
+    }
+    return NULL;
+}
+
+bool start_scheduler() {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        printf("[WARN] mlockall failed, page faults may cause deadline misses.\n");
+    }
+
+    for (size_t i = 0; i < NUM_TASKS; i++) {
+        int rank = 0;
+        for (size_t j = 0; j < NUM_TASKS; j++) {
+            if (tasks[j].period_us < tasks[i].period_us) {
+                rank++;
+            }
+        }
+        tasks[i].priority = RT_PRIORITY_TOP - rank;
+    }
+
+    for (size_t i = 0; i < NUM_TASKS; i++) {
+        rt_task_t *task = &tasks[i];
+        pthread_attr_t attr;
+        struct sched_param param = { .sched_priority = task->priority };
+
+        pthread_attr_init(&attr);
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+        if (task->cpu >= 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(task->cpu, &cpus);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+        }
+        int err = pthread_create(&task->thread, &attr, task_thread, task);
+        if (err != 0) {
+            // No CAP_SYS_NICE: run best-effort, still pinned to its core
+            printf("[WARN] Task %s running without real-time priority.\n", task->name);
+            pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+            err = pthread_create(&task->thread, &attr, task_thread, task);
+        }
+        if (err != 0 && task->cpu >= 0) {
+            // Core unavailable as well
+            printf("[WARN] Task %s not pinned to CPU %d.\n", task->name, task->cpu);
+            err = pthread_create(&task->thread, NULL, task_thread, task);
+        }
+        pthread_attr_destroy(&attr);
+        if (err != 0) {
+            // Never run with a task missing: stop the ones already started
+            printf("[ERROR] Could not start task %s, stopping the scheduler.\n", task->name);
+            scheduler_running = false;
+            for (size_t j = 0; j < i; j++) {
+                pthread_join(tasks[j].thread, NULL);
+            }
+            motor_stop();
+            return false;
+        }
+    }
+    return true;
+}
+
+void print_scheduler_stats() {
+    for (size_t i = 0; i < NUM_TASKS; i++) {
+        rt_task_t *task = &tasks[i];
+        printf("Task %-9s %6u us prio %d - runs: %llu, misses: %u, max jitter: %u us, hist:",
+               task->name, task->period_us, task->priority, (unsigned long long)task->runs,
+               task->deadline_misses, task->max_jitter_us);
+        for (int b = 0; b < JITTER_BUCKETS; b++) {
+            printf(" %u", task->jitter_hist[b]);
+        }
+        printf("\n");
+    }
+    uint64_t control_runs = tasks[0].runs;
+    printf("Telemetry - sent: %u, spooled: %u, lost: %u, dropped records: %u, control loop cost: avg %llu ns, max %u ns, fusion max %u ns, inference max %u us\n",
+           telemetry_batches_sent, telemetry_batches_spooled, telemetry_batches_lost, telemetry_dropped,
+           control_runs ? (unsigned long long)(telemetry_enqueue_ns / control_runs) : 0ULL, telemetry_enqueue_max_ns, fusion_max_ns, inference_max_us);
+    if (trace_mode == TRACE_RECORD) {
+        printf("Trace - dropped records: %u\n", trace_dropped);
+    }
+}
@@ -1,6 +1,15 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include "heart_rate_sensor.h"  // Simulated heart rate sensor
 #include "spo2_sensor.h"        // Simulated SpO2 sensor
 #include "temperature_sensor.h" // Simulated temperature sensor
@@ -17,15 +26,202 @@
 #define SPO2_THRESHOLD 90         // Alert threshold for SpO2
 #define TEMP_THRESHOLD 38         // Alert threshold for body temperature
 
+#define ECG_SAMPLE_RATE 500       // Hz, the ECG front end supports 250-1000
+#define ECG_RING_SIZE 2048        // Raw samples staged between sensor reads and filtering
+#define ECG_BLOCK 64              // Samples per filter pass
+#define ECG_BP_LOW_HZ 5.0f
+#define ECG_BP_HIGH_HZ 15.0f
+#define ECG_BP_TAPS ((ECG_SAMPLE_RATE / 4) | 1)       // Odd, linear phase
+#define ECG_MWI_WINDOW (ECG_SAMPLE_RATE * 150 / 1000) // 150 ms integration window
+#define ECG_REFRACTORY (ECG_SAMPLE_RATE * 200 / 1000)
+#define ECG_T_WAVE_WINDOW (ECG_SAMPLE_RATE * 360 / 1000)
+#define ECG_LEARN_SAMPLES (ECG_SAMPLE_RATE * 2)
+#define ECG_RR_HISTORY 8
+
+#define MAX_PATIENTS 10000        // Wearables aggregated by this gateway
+#define LOCAL_PATIENT 0           // Slot used by the directly attached sensors
+#define ENGINE_SHARDS 4           // Worker threads, each owning a contiguous patient range
+#define ENGINE_TICK_MS 20         // Evaluation period of each shard
+#define ALERT_QUEUE_SIZE 4096     // Per shard, power of two
+#define TREND_ALPHA 0.01f         // Baseline EWMA weight per sample (~100 s at 1 Hz)
+#define TREND_HR_RISE 25.0f       // bpm above baseline
+#define TREND_SPO2_DROP 4.0f      // % below baseline
+#define BENCH_SECONDS 5
+
+#define HEALTH_API_URL "http://healthmonitoring-api.com/logs"
+#define UPLOAD_WINDOW_S 10        // Seconds of vitals per upload
+#define UPLOAD_QUEUE 8            // Sealed windows waiting for the sender
+#define UPLOAD_ENCODED_MAX (UPLOAD_WINDOW_S * 6 * 5 + 256)
+#define UPLOAD_MESSAGE_MAX (UPLOAD_ENCODED_MAX * 4 / 3 + 16)
+#define UPLOAD_LOG_PATH "health_upload.log"
+#define UPLOAD_ACK_PATH "health_upload.ack"
+
+#define TSDB_BLOCK_SIZE 4096      // Bytes per compressed block, header included
+#define TSDB_BLOCKS 512           // Ring of blocks per series file (weeks at 1 Hz)
+#define TSDB_MINUTE_SLOTS (7 * 24 * 60)   // 1 min rollups kept for a week
+#define TSDB_HOUR_SLOTS (365 * 24)        // 1 h rollups kept for a year
+#define TSDB_MAGIC 0x42445354u            // "TSDB"
+#define TSDB_DROP_REPORT 3600             // Samples between reports of a store that is not open
+
+#define ALERT_HEART_RATE 0x01
+#define ALERT_SPO2 0x02
+#define ALERT_TEMPERATURE 0x04
+#define ALERT_HR_TREND 0x08
+#define ALERT_SPO2_TREND 0x10
+
+// One ECG lead: raw sample ring, filter histories and QRS detector state
+typedef struct {
+    int16_t ring[ECG_RING_SIZE];
+    uint32_t ring_head, ring_tail;
+    float bp_in[ECG_BP_TAPS - 1 + ECG_BLOCK];
+    float bp_out[4 + ECG_BLOCK];
+    float sq[ECG_MWI_WINDOW + ECG_BLOCK];
+    double mwi_sum;
+    int64_t sample_index;
+    float prev, peak;
+    int64_t peak_index;
+    bool rising;
+    float learn_max;
+    double learn_sum;
+    float spki, npki, threshold;           // Signal/noise peak levels, detection threshold
+    float searchback_peak;
+    int64_t searchback_index;
+    int64_t last_qrs;
+    float last_qrs_peak;
+    uint32_t rr[ECG_RR_HISTORY];           // Samples between beats
+    uint32_t rr_count, rr_avg, rr_ms;
+    uint16_t heart_rate;
+    uint32_t beats;
+    uint64_t samples_processed, samples_dropped, cpu_ns;
+} ecg_channel_t;
+
+typedef struct {
+    uint32_t t_s;
+    uint8_t heart_rate;
+    uint8_t spo2;
+    int16_t temp_dc;          // 0.1 °C
+    uint16_t rr_ms;
+    uint8_t flags;            // Bit 0: emergency alert
+} vitals_record_t;
+
+typedef enum {
+    SERIES_HEART_RATE,
+    SERIES_SPO2,
+    SERIES_TEMPERATURE,
+    SERIES_RR_INTERVAL,
+    NUM_SERIES
+} series_id_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t bits;            // Payload bits used
+    uint32_t count;
+    uint32_t reserved;
+    int64_t start_ms, end_ms;
+    double first_value;
+    double min, max, sum;     // Lets range aggregates skip decoding covered blocks
+} tsdb_block_header_t;
+
+typedef struct {
+    tsdb_block_header_t header;
+    uint8_t payload[TSDB_BLOCK_SIZE - sizeof(tsdb_block_header_t)];
+} tsdb_block_t;
+
+#define TSDB_PAYLOAD_BITS (8 * (TSDB_BLOCK_SIZE - sizeof(tsdb_block_header_t)))
+
+typedef struct {
+    int64_t bucket;           // t_ms / period
+    uint32_t count;
+    float min, max;
+    double sum;
+} tsdb_rollup_t;
+
+typedef struct {
+    uint64_t count;
+    double min, max, sum;
+} tsdb_aggregate_t;
+
+// One mmap'd series file plus the encoder state for its newest block
+typedef struct {
+    tsdb_block_t *blocks;
+    int current;
+    int64_t prev_ms, prev_delta;
+    uint64_t prev_value;
+    uint8_t prev_leading, prev_trailing;
+    tsdb_rollup_t *minutes, *hours;
+    uint64_t dropped;         // Appends while the store could not be opened
+} tsdb_series_t;
+
+typedef struct {
+    uint32_t start_s;
+    uint32_t count;
+    vitals_record_t records[UPLOAD_WINDOW_S];
+    char report[200];         // AI report at the end of the window
+} vitals_batch_t;
+
+typedef struct {
+    uint32_t patient;         // Index within the shard
+    float heart_rate, spo2, temperature;
+    uint64_t t_us;
+} patient_sample_t;
+
+typedef struct {
+    uint32_t patient;
+    uint8_t flags;            // ALERT_* set now in effect, 0 when cleared
+    uint32_t latency_us;      // Sample ingest to detection
+} alert_event_t;
+
+// Structure-of-arrays vitals table for one shard plus its ingest and alert queues
+typedef struct {
+    uint32_t first, count;
+    float *heart_rate, *spo2, *temperature;
+    float *hr_baseline, *spo2_baseline;
+    uint64_t *sample_us;
+    uint8_t *flags, *prev_flags, *changed;
+    pthread_mutex_t lock;     // Guards pending / pending_count
+    patient_sample_t *pending, *applying;
+    size_t pending_count, pending_cap;
+    uint64_t samples_dropped;
+    alert_event_t alerts[ALERT_QUEUE_SIZE]; // SPSC: shard thread -> main loop
+    _Atomic uint32_t alert_head, alert_tail;
+    uint64_t alerts_deferred;
+    _Atomic uint64_t ticks;
+    pthread_t thread;
+} shard_t;
+
 void init_system();
 void read_sensors();
 void process_health_data();
 void send_data();
 void trigger_alert();
 void ai_health_analysis();
-void upload_to_cloud();
 void sync_wearable_data();
 void voice_alert();
+void ecg_design_bandpass();
+void ecg_channel_init(ecg_channel_t *ch);
+void ecg_push_samples(ecg_channel_t *ch, const int16_t *samples, size_t count);
+void ecg_process_available(ecg_channel_t *ch);
+void ecg_process_block(ecg_channel_t *ch);
+void ecg_detect(ecg_channel_t *ch, float v);
+void *ecg_thread(void *arg);
+uint64_t monotonic_us();
+bool engine_init(uint32_t num_patients);
+void engine_shutdown();
+void engine_ingest(uint32_t patient, float heart_rate, float spo2, float temperature);
+bool engine_next_alert(alert_event_t *event);
+void engine_sync(uint32_t patient);
+void *shard_thread(void *arg);
+void run_load_benchmark();
+void upload_log_open();
+bool tsdb_open(tsdb_series_t *series, const char *path);
+void tsdb_append(tsdb_series_t *series, int64_t t_ms, double value);
+void tsdb_rollup_add(tsdb_rollup_t *slots, int num_slots, int64_t period_ms, int64_t t_ms, double value);
+void tsdb_aggregate(const tsdb_series_t *series, int64_t from_ms, int64_t to_ms, tsdb_aggregate_t *agg);
+void tsdb_rollup_aggregate(const tsdb_series_t *series, int64_t from_ms, int64_t to_ms, bool hourly, tsdb_aggregate_t *agg);
+int64_t wall_clock_ms();
+void store_vitals_history();
+void run_history_benchmark();
+void *upload_thread(void *arg);
 
 uint8_t heart_rate = 0;
 uint8_t spo2 = 0;
@@ -33,17 +229,57 @@ float body_temperature = 0.0;
 bool emergency_alert = false;
 char ecg_data[100];
 char health_report[200];
+uint16_t rr_interval_ms = 0;
 
-int main() {
+float ecg_bp_taps[ECG_BP_TAPS];
+ecg_channel_t ecg_channel;
+pthread_mutex_t ecg_lock = PTHREAD_MUTEX_INITIALIZER; // Guards ecg_channel against the 1 Hz reader
+
+shard_t shards[ENGINE_SHARDS];
+uint32_t engine_patients = 0;
+uint32_t engine_shard_size = 1;
+_Atomic bool engine_running = false;
+int engine_threads = 0;       // Shards whose thread was started
+
+vitals_batch_t upload_batches[UPLOAD_QUEUE];
+uint32_t upload_head = 0, upload_tail = 0; // Guarded by upload_lock
+pthread_mutex_t upload_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t upload_ready = PTHREAD_COND_INITIALIZER;
+uint32_t upload_windows_dropped = 0;
+int upload_log_fd = -1;
+long upload_log_acked = 0;
+bool upload_log_pending = false;
+_Atomic uint32_t upload_windows_logged = 0;
+_Atomic uint64_t upload_encoded_bytes = 0;
+_Atomic uint64_t upload_wire_bytes = 0;
+uint64_t send_blocked_ns = 0;
+uint32_t send_blocked_max_ns = 0;
+uint32_t send_calls = 0;
+
+tsdb_series_t vitals_history[NUM_SERIES];
+const char *series_names[NUM_SERIES] = {"heart_rate", "spo2", "temperature", "rr_interval"};
+
+// Usage: health                 run the monitor
+//        health bench           multi-patient alert latency benchmark
+//        health history-bench   vitals history store benchmark
+int main(int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        run_load_benchmark();
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "history-bench") == 0) {
+        run_history_benchmark();
+        return 0;
+    }
     init_system();
     
     while (1) {
         sync_wearable_data();
         read_sensors();
         process_health_data();
+        store_vitals_history();
         ai_health_analysis();
         send_data();
-        upload_to_cloud();
         if (emergency_alert) {
             trigger_alert();
             voice_alert();
@@ -66,6 +302,35 @@ void init_system() {
     cloud_storage_init();
     wearable_device_init();
     voice_alert_init();
+
+    pthread_t ecg;
+    ecg_design_bandpass();
+    ecg_channel_init(&ecg_channel);
+    if (pthread_create(&ecg, NULL, ecg_thread, &ecg_channel) == 0) {
+        pthread_detach(ecg);
+    } else {
+        printf("[WARN] ECG analysis disabled, heart rate comes from the sensor.\n");
+    }
+
+    if (!engine_init(MAX_PATIENTS)) {
+        printf("[WARN] Multi-patient engine unavailable, checking local thresholds only.\n");
+    }
+
+    for (int s = 0; s < NUM_SERIES; s++) {
+        char path[64];
+        sprintf(path, "vitals_%s.tsdb", series_names[s]);
+        if (!tsdb_open(&vitals_history[s], path)) {
+            printf("[WARN] %s history disabled, samples will be dropped.\n", series_names[s]);
+        }
+    }
+
+    pthread_t uploader;
+    upload_log_open();
+    if (pthread_create(&uploader, NULL, upload_thread, NULL) == 0) {
+        pthread_detach(uploader);
+    } else {
+        printf("[WARN] Telemetry sender not started, windows will be dropped.\n");
+    }
 }
 
 void sync_wearable_data() {
@@ -74,36 +339,105 @@ void sync_wearable_data() {
 }
 
 void read_sensors() {
-    heart_rate = read_heart_rate();
     spo2 = read_spo2();
     body_temperature = read_temperature();
-    read_ecg(ecg_data);
+
+    // Heart rate comes from the ECG beat detector while it has a lock
+    pthread_mutex_lock(&ecg_lock);
+    ecg_channel_t *ch = &ecg_channel;
+    bool locked = ch->rr_avg && ch->sample_index - ch->last_qrs < 3 * ECG_SAMPLE_RATE;
+    double channel_s = (double)ch->samples_processed / ECG_SAMPLE_RATE;
+    double cpu_s = ch->cpu_ns * 1e-9;
+    heart_rate = locked ? (uint8_t)(ch->heart_rate > 255 ? 255 : ch->heart_rate) : read_heart_rate();
+    rr_interval_ms = locked ? (uint16_t)ch->rr_ms : 0;
+    sprintf(ecg_data, "HR %d bpm, RR %d ms, beats %u%s", heart_rate, rr_interval_ms, ch->beats, locked ? "" : " (no lock)");
+    uint64_t dropped = ch->samples_dropped;
+    pthread_mutex_unlock(&ecg_lock);
+
     printf("Heart Rate: %d bpm, SpO2: %d%%, Body Temperature: %.1f°C, ECG: %s\n", heart_rate, spo2, body_temperature, ecg_data);
+    printf("ECG pipeline: %.0f channel-s per CPU-s, %llu samples dropped\n",
+           cpu_s > 0.0 ? channel_s / cpu_s : 0.0, (unsigned long long)dropped);
 }
 
+// Feeds the local readings to the engine and collects alert transitions for
+// every patient; emergency_alert follows the local patient's flags. Without
+// the engine the local thresholds are checked directly.
 void process_health_data() {
-    emergency_alert = false;
-    if (heart_rate > HEART_RATE_THRESHOLD || spo2 < SPO2_THRESHOLD || body_temperature > TEMP_THRESHOLD) {
-        emergency_alert = true;
+    static uint8_t local_flags = 0;
+    alert_event_t event;
+
+    if (!engine_running) {
+        emergency_alert = heart_rate > HEART_RATE_THRESHOLD || spo2 < SPO2_THRESHOLD || body_temperature > TEMP_THRESHOLD;
+        return;
     }
+    engine_ingest(LOCAL_PATIENT, heart_rate, spo2, body_temperature);
+    engine_sync(LOCAL_PATIENT);
+    while (engine_next_alert(&event)) {
+        if (event.patient == LOCAL_PATIENT) {
+            local_flags = event.flags;
+        } else if (event.flags) {
+            printf("[ALERT] Patient %u: flags 0x%02x (detected in %.1f ms)\n", event.patient, event.flags, event.latency_us / 1000.0);
+        }
+    }
+    emergency_alert = local_flags != 0;
 }
 
 void ai_health_analysis() {
+    tsdb_aggregate_t spo2_6h, hr_1h;
+    int64_t now = wall_clock_ms();
+
     analyze_health_data(heart_rate, spo2, body_temperature, ecg_data, health_report);
+    tsdb_rollup_aggregate(&vitals_history[SERIES_SPO2], now - 6 * 3600000LL, now, false, &spo2_6h);
+    tsdb_rollup_aggregate(&vitals_history[SERIES_HEART_RATE], now - 3600000LL, now, false, &hr_1h);
+    if (spo2_6h.count && hr_1h.count) {
+        size_t len = strlen(health_report);
+        snprintf(health_report + len, sizeof(health_report) - len, " | SpO2 6h avg %.1f%% min %.0f%%, HR 1h avg %.0f bpm",
+                 spo2_6h.sum / spo2_6h.count, spo2_6h.min, hr_1h.sum / hr_1h.count);
+    }
     printf("AI Health Analysis Report: %s\n", health_report);
 }
 
+// Appends this second's vitals to the open upload window; the sender thread
+// does all encoding, disk and network I/O, so this never blocks on a sink
 void send_data() {
-    char log_data[200];
-    sprintf(log_data, "HR: %d bpm, SpO2: %d%%, Temp: %.1f°C, ECG: %s, AI Report: %s", heart_rate, spo2, body_temperature, ecg_data, health_report);
-    wifi_send_data("http://healthmonitoring-api.com/logs", log_data);
-    bluetooth_send(log_data);
-    printf("Data sent to monitoring system: %s\n", log_data);
-}
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_mutex_lock(&upload_lock);
+    vitals_batch_t *batch = &upload_batches[upload_head % UPLOAD_QUEUE];
+    if (batch->count == 0) {
+        batch->start_s = (uint32_t)time(NULL);
+    }
+    vitals_record_t *record = &batch->records[batch->count++];
+    record->t_s = (uint32_t)time(NULL);
+    record->heart_rate = heart_rate;
+    record->spo2 = spo2;
+    record->temp_dc = (int16_t)lroundf(body_temperature * 10.0f);
+    record->rr_ms = rr_interval_ms;
+    record->flags = emergency_alert ? 1 : 0;
+    if (batch->count == UPLOAD_WINDOW_S) {
+        strcpy(batch->report, health_report);
+        upload_head++;
+        if (upload_head - upload_tail > UPLOAD_QUEUE - 1) {
+            upload_tail++; // Sender is stuck on a sink; oldest window is lost
+            upload_windows_dropped++;
+        }
+        upload_batches[upload_head % UPLOAD_QUEUE].count = 0;
+        pthread_cond_signal(&upload_ready);
+    }
+    pthread_mutex_unlock(&upload_lock);
 
-void upload_to_cloud() {
-    upload_health_data(log_data);
-    printf("Health data uploaded to cloud analytics platform.\n");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint32_t blocked_ns = (uint32_t)((end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec));
+    send_blocked_ns += blocked_ns;
+    send_blocked_max_ns = blocked_ns > send_blocked_max_ns ? blocked_ns : send_blocked_max_ns;
+    send_calls++;
+    if (send_calls % UPLOAD_WINDOW_S == 0) {
+        double hours = send_calls / 3600.0;
+        printf("Telemetry: %.0f B/patient-hour encoded, %.0f B/patient-hour sent, main loop blocked avg %.1f us, max %.1f us, %u windows logged offline, %u dropped\n",
+               upload_encoded_bytes / hours, upload_wire_bytes / hours, send_blocked_ns / 1000.0 / send_calls,
+               send_blocked_max_ns / 1000.0, upload_windows_logged, upload_windows_dropped);
+    }
 }
 
 void trigger_alert() {
@@ -115,3 +449,1040 @@ void voice_alert() {
     play_voice_alert("Warning: Abnormal health readings detected. Please seek medical attention.");
     printf("Voice alert triggered.\n");
 }
+
+// Windowed-sinc (Hamming) 5-15 Hz band-pass, the QRS energy band Pan-Tompkins filters for
+void ecg_design_bandpass() {
+    const float f1 = ECG_BP_LOW_HZ / (float)ECG_SAMPLE_RATE;
+    const float f2 = ECG_BP_HIGH_HZ / (float)ECG_SAMPLE_RATE;
+    const int mid = ECG_BP_TAPS / 2;
+    for (int n = 0; n < ECG_BP_TAPS; n++) {
+        int m = n - mid;
+        float h = m == 0 ? 2.0f * (f2 - f1)
+                         : (sinf(2.0f * (float)M_PI * f2 * m) - sinf(2.0f * (float)M_PI * f1 * m)) / ((float)M_PI * m);
+        ecg_bp_taps[n] = h * (0.54f - 0.46f * cosf(2.0f * (float)M_PI * n / (ECG_BP_TAPS - 1)));
+    }
+}
+
+void ecg_channel_init(ecg_channel_t *ch) {
+    memset(ch, 0, sizeof(*ch));
+    ch->last_qrs = -1;
+}
+
+// Producer side of the raw sample ring; overwrites the oldest samples if processing stalls
+void ecg_push_samples(ecg_channel_t *ch, const int16_t *samples, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (ch->ring_head - ch->ring_tail == ECG_RING_SIZE) {
+            ch->ring_tail++;
+            ch->samples_dropped++;
+        }
+        ch->ring[ch->ring_head++ & (ECG_RING_SIZE - 1)] = samples[i];
+    }
+}
+
+// Consumes whole blocks from the ring and runs the filter chain over each
+void ecg_process_available(ecg_channel_t *ch) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    while (ch->ring_head - ch->ring_tail >= ECG_BLOCK) {
+        float *x = ch->bp_in + ECG_BP_TAPS - 1;
+        for (int i = 0; i < ECG_BLOCK; i++) {
+            x[i] = ch->ring[(ch->ring_tail + i) & (ECG_RING_SIZE - 1)];
+        }
+        ch->ring_tail += ECG_BLOCK;
+        ecg_process_block(ch);
+    }
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    ch->cpu_ns += (uint64_t)((end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec));
+}
+
+// Band-pass -> derivative -> squaring -> moving-window integration, one block at
+// a time. Every stage except the integrator's running sum is an element-wise
+// loop over the block, so -O3 turns them into SIMD; each stage keeps just enough
+// history in front of its buffer to span block boundaries.
+void ecg_process_block(ecg_channel_t *ch) {
+    float *x = ch->bp_in;            // [ECG_BP_TAPS - 1 history | ECG_BLOCK new]
+    float *bp = ch->bp_out + 4;      // [4 history | ECG_BLOCK]
+    float *sq = ch->sq + ECG_MWI_WINDOW;
+    float diff[ECG_BLOCK];
+
+    for (int i = 0; i < ECG_BLOCK; i++) {
+        bp[i] = 0.0f;
+    }
+    for (int k = 0; k < ECG_BP_TAPS; k++) {
+        const float h = ecg_bp_taps[k];
+        for (int i = 0; i < ECG_BLOCK; i++) {
+            bp[i] += h * x[i + k];
+        }
+    }
+    for (int i = 0; i < ECG_BLOCK; i++) {
+        float d = (2.0f * bp[i] + bp[i - 1] - bp[i - 3] - 2.0f * bp[i - 4]) * 0.125f;
+        sq[i] = d * d;
+    }
+    for (int i = 0; i < ECG_BLOCK; i++) {
+        diff[i] = sq[i] - sq[i - ECG_MWI_WINDOW];
+    }
+    for (int i = 0; i < ECG_BLOCK; i++) {
+        ch->mwi_sum += diff[i];
+        ecg_detect(ch, (float)(ch->mwi_sum * (1.0 / ECG_MWI_WINDOW)));
+    }
+
+    memmove(ch->bp_in, ch->bp_in + ECG_BLOCK, (ECG_BP_TAPS - 1) * sizeof(float));
+    memmove(ch->bp_out, ch->bp_out + ECG_BLOCK, 4 * sizeof(float));
+    memmove(ch->sq, ch->sq + ECG_BLOCK, ECG_MWI_WINDOW * sizeof(float));
+    ch->samples_processed += ECG_BLOCK;
+}
+
+void ecg_accept_qrs(ecg_channel_t *ch, int64_t index, float peak) {
+    if (ch->last_qrs >= 0) {
+        uint32_t rr = (uint32_t)(index - ch->last_qrs);
+        ch->rr[ch->rr_count++ % ECG_RR_HISTORY] = rr;
+        uint32_t n = ch->rr_count < ECG_RR_HISTORY ? ch->rr_count : ECG_RR_HISTORY;
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            sum += ch->rr[i];
+        }
+        ch->rr_avg = sum / n;
+        ch->rr_ms = rr * 1000 / ECG_SAMPLE_RATE;
+        ch->heart_rate = (uint16_t)(60 * ECG_SAMPLE_RATE / ch->rr_avg);
+    }
+    ch->last_qrs = index;
+    ch->last_qrs_peak = peak;
+    ch->searchback_peak = 0.0f;
+    ch->beats++;
+}
+
+// Adaptive-threshold classification of one integrated-signal peak
+void ecg_classify_peak(ecg_channel_t *ch, float peak, int64_t index) {
+    int64_t since = ch->last_qrs >= 0 ? index - ch->last_qrs : INT64_MAX;
+    if (since < ECG_REFRACTORY) {
+        return;
+    }
+    bool t_wave = since < ECG_T_WAVE_WINDOW && peak < 0.5f * ch->last_qrs_peak;
+    if (peak > ch->threshold && !t_wave) {
+        ch->spki = 0.125f * peak + 0.875f * ch->spki;
+        ecg_accept_qrs(ch, index, peak);
+    } else {
+        ch->npki = 0.125f * peak + 0.875f * ch->npki;
+        if (peak > ch->searchback_peak && !t_wave) {
+            ch->searchback_peak = peak;
+            ch->searchback_index = index;
+        }
+    }
+    ch->threshold = ch->npki + 0.25f * (ch->spki - ch->npki);
+}
+
+void ecg_detect(ecg_channel_t *ch, float v) {
+    int64_t n = ch->sample_index++;
+
+    // Two-second learning phase seeds the signal/noise peak estimates
+    if (n < ECG_LEARN_SAMPLES) {
+        ch->learn_max = v > ch->learn_max ? v : ch->learn_max;
+        ch->learn_sum += v;
+        if (n == ECG_LEARN_SAMPLES - 1) {
+            ch->spki = ch->learn_max / 3.0f;
+            ch->npki = (float)(ch->learn_sum / ECG_LEARN_SAMPLES) / 2.0f;
+            ch->threshold = ch->npki + 0.25f * (ch->spki - ch->npki);
+        }
+        ch->prev = v;
+        return;
+    }
+
+    if (v > ch->prev) {
+        ch->rising = true;
+    }
+    if (ch->rising && v > ch->peak) {
+        ch->peak = v;
+        ch->peak_index = n;
+    } else if (ch->rising && v < 0.5f * ch->peak) {
+        ecg_classify_peak(ch, ch->peak, ch->peak_index);
+        ch->peak = 0.0f;
+        ch->rising = false;
+    }
+    ch->prev = v;
+
+    // Search back for a missed beat once 166% of the average RR has elapsed
+    if (ch->rr_avg && ch->last_qrs >= 0 && n - ch->last_qrs > (int64_t)ch->rr_avg * 166 / 100
+        && ch->searchback_peak > 0.5f * ch->threshold) {
+        ch->spki = 0.25f * ch->searchback_peak + 0.75f * ch->spki;
+        ecg_accept_qrs(ch, ch->searchback_index, ch->searchback_peak);
+        ch->threshold = ch->npki + 0.25f * (ch->spki - ch->npki);
+    }
+}
+
+void *ecg_thread(void *arg) {
+    ecg_channel_t *ch = arg;
+    int16_t chunk[ECG_BLOCK];
+    while (1) {
+        size_t count = ecg_read_samples(chunk, ECG_BLOCK); // Drains the sensor FIFO
+        if (count == 0) {
+            usleep(ECG_BLOCK * 1000000 / ECG_SAMPLE_RATE / 2);
+            continue;
+        }
+        pthread_mutex_lock(&ecg_lock);
+        ecg_push_samples(ch, chunk, count);
+        ecg_process_available(ch);
+        pthread_mutex_unlock(&ecg_lock);
+    }
+    return NULL;
+}
+
+uint64_t monotonic_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Patients are split into contiguous ranges, one per worker thread, so each
+// shard's vitals table is touched by exactly one thread. On failure nothing
+// is left running and engine_running stays false.
+bool engine_init(uint32_t num_patients) {
+    uint32_t shard_size = (num_patients + ENGINE_SHARDS - 1) / ENGINE_SHARDS;
+
+    memset(shards, 0, sizeof(shards));
+    for (int s = 0; s < ENGINE_SHARDS; s++) {
+        pthread_mutex_init(&shards[s].lock, NULL);
+    }
+    for (int s = 0; s < ENGINE_SHARDS; s++) {
+        shard_t *shard = &shards[s];
+        uint32_t first = s * shard_size;
+        uint32_t count = first >= num_patients ? 0 : num_patients - first;
+        count = count > shard_size ? shard_size : count;
+        shard->first = first;
+        shard->count = count;
+        shard->heart_rate = calloc(count + 1, sizeof(float));
+        shard->spo2 = calloc(count + 1, sizeof(float));
+        shard->temperature = calloc(count + 1, sizeof(float));
+        shard->hr_baseline = calloc(count + 1, sizeof(float));
+        shard->spo2_baseline = calloc(count + 1, sizeof(float));
+        shard->sample_us = calloc(count + 1, sizeof(uint64_t));
+        shard->flags = calloc(count + 8, 1);
+        shard->prev_flags = calloc(count + 8, 1);
+        shard->changed = calloc(count + 8, 1);
+        shard->pending_cap = (count + 1) * 4;
+        shard->pending = calloc(shard->pending_cap, sizeof(patient_sample_t));
+        shard->applying = calloc(shard->pending_cap, sizeof(patient_sample_t));
+        if (!shard->heart_rate || !shard->spo2 || !shard->temperature || !shard->hr_baseline || !shard->spo2_baseline
+            || !shard->sample_us || !shard->flags || !shard->prev_flags || !shard->changed || !shard->pending || !shard->applying) {
+            printf("[ERROR] Not enough memory for %u patients.\n", num_patients);
+            engine_shutdown();
+            return false;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            shard->spo2[i] = 100.0f; // Neutral until the first sample arrives
+            shard->spo2_baseline[i] = 100.0f;
+        }
+    }
+    engine_shard_size = shard_size;
+    engine_patients = num_patients;
+    engine_running = true;
+    for (; engine_threads < ENGINE_SHARDS; engine_threads++) {
+        if (pthread_create(&shards[engine_threads].thread, NULL, shard_thread, &shards[engine_threads]) != 0) {
+            printf("[ERROR] Could not start multi-patient engine thread %d.\n", engine_threads);
+            engine_shutdown();
+            return false;
+        }
+    }
+    return true;
+}
+
+// Also undoes a partial engine_init
+void engine_shutdown() {
+    engine_running = false;
+    engine_patients = 0;
+    for (int s = 0; s < engine_threads; s++) {
+        pthread_join(shards[s].thread, NULL);
+    }
+    engine_threads = 0;
+    for (int s = 0; s < ENGINE_SHARDS; s++) {
+        shard_t *shard = &shards[s];
+        pthread_mutex_destroy(&shard->lock);
+        free(shard->heart_rate);
+        free(shard->spo2);
+        free(shard->temperature);
+        free(shard->hr_baseline);
+        free(shard->spo2_baseline);
+        free(shard->sample_us);
+        free(shard->flags);
+        free(shard->prev_flags);
+        free(shard->changed);
+        free(shard->pending);
+        free(shard->applying);
+    }
+}
+
+// Called by whatever receives wearable packets; O(1) under the shard's ingest lock
+void engine_ingest(uint32_t patient, float heart_rate, float spo2, float temperature) {
+    if (patient >= engine_patients) {
+        return;
+    }
+    shard_t *shard = &shards[patient / engine_shard_size];
+    pthread_mutex_lock(&shard->lock);
+    if (shard->pending_count < shard->pending_cap) {
+        patient_sample_t *sample = &shard->pending[shard->pending_count++];
+        sample->patient = patient - shard->first;
+        sample->heart_rate = heart_rate;
+        sample->spo2 = spo2;
+        sample->temperature = temperature;
+        sample->t_us = monotonic_us();
+    } else {
+        shard->samples_dropped++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+// Swaps out the ingest buffer and folds it into the table, updating the trend baselines
+void shard_apply_samples(shard_t *shard) {
+    pthread_mutex_lock(&shard->lock);
+    patient_sample_t *samples = shard->pending;
+    size_t count = shard->pending_count;
+    shard->pending = shard->applying;
+    shard->applying = samples;
+    shard->pending_count = 0;
+    pthread_mutex_unlock(&shard->lock);
+
+    for (size_t n = 0; n < count; n++) {
+        uint32_t i = samples[n].patient;
+        bool first = shard->sample_us[i] == 0;
+        shard->hr_baseline[i] = first ? samples[n].heart_rate
+                              : shard->hr_baseline[i] + TREND_ALPHA * (samples[n].heart_rate - shard->hr_baseline[i]);
+        shard->spo2_baseline[i] = first ? samples[n].spo2
+                                : shard->spo2_baseline[i] + TREND_ALPHA * (samples[n].spo2 - shard->spo2_baseline[i]);
+        shard->heart_rate[i] = samples[n].heart_rate;
+        shard->spo2[i] = samples[n].spo2;
+        shard->temperature[i] = samples[n].temperature;
+        shard->sample_us[i] = samples[n].t_us;
+    }
+}
+
+// Threshold and trend rules over the whole shard as straight-line loops the
+// compiler vectorizes; alerts are emitted only where the flag set changed
+void shard_evaluate(shard_t *shard) {
+    const uint32_t count = shard->count;
+    const float *hr = shard->heart_rate, *spo2 = shard->spo2, *temp = shard->temperature;
+    const float *hr_base = shard->hr_baseline, *spo2_base = shard->spo2_baseline;
+    uint8_t *flags = shard->flags, *prev = shard->prev_flags, *changed = shard->changed;
+
+    for (uint32_t i = 0; i < count; i++) {
+        flags[i] = (uint8_t)((hr[i] > HEART_RATE_THRESHOLD) * ALERT_HEART_RATE
+                           | (spo2[i] < SPO2_THRESHOLD) * ALERT_SPO2
+                           | (temp[i] > TEMP_THRESHOLD) * ALERT_TEMPERATURE
+                           | (hr[i] - hr_base[i] > TREND_HR_RISE) * ALERT_HR_TREND
+                           | (spo2_base[i] - spo2[i] > TREND_SPO2_DROP) * ALERT_SPO2_TREND);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        changed[i] = flags[i] ^ prev[i];
+    }
+
+    uint64_t now = monotonic_us();
+    for (uint32_t i = 0; i < count; i += 8) {
+        uint64_t word;
+        memcpy(&word, changed + i, sizeof(word)); // Skip 8 unchanged patients at a time
+        if (word == 0) {
+            continue;
+        }
+        for (uint32_t j = i; j < i + 8 && j < count; j++) {
+            if (!changed[j]) {
+                continue;
+            }
+            alert_event_t event = {shard->first + j, flags[j], (uint32_t)(now - shard->sample_us[j])};
+            uint32_t head = atomic_load_explicit(&shard->alert_head, memory_order_relaxed);
+            if (head - atomic_load_explicit(&shard->alert_tail, memory_order_acquire) < ALERT_QUEUE_SIZE) {
+                shard->alerts[head & (ALERT_QUEUE_SIZE - 1)] = event;
+                atomic_store_explicit(&shard->alert_head, head + 1, memory_order_release);
+                prev[j] = flags[j];
+            } else {
+                shard->alerts_deferred++;  // Edge kept pending, retried next tick
+            }
+        }
+    }
+}
+
+void *shard_thread(void *arg) {
+    shard_t *shard = arg;
+    while (engine_running) {
+        shard_apply_samples(shard);
+        shard_evaluate(shard);
+        shard->ticks++;
+        usleep(ENGINE_TICK_MS * 1000);
+    }
+    return NULL;
+}
+
+bool engine_next_alert(alert_event_t *event) {
+    for (int s = 0; s < ENGINE_SHARDS; s++) {
+        shard_t *shard = &shards[s];
+        uint32_t tail = atomic_load_explicit(&shard->alert_tail, memory_order_relaxed);
+        if (tail != atomic_load_explicit(&shard->alert_head, memory_order_acquire)) {
+            *event = shard->alerts[tail & (ALERT_QUEUE_SIZE - 1)];
+            atomic_store_explicit(&shard->alert_tail, tail + 1, memory_order_release);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Waits until the patient's shard has completed a full apply + evaluate pass
+void engine_sync(uint32_t patient) {
+    shard_t *shard = &shards[patient / engine_shard_size];
+    uint64_t target = shard->ticks + 2;
+    while (shard->ticks < target) {
+        usleep(1000);
+    }
+}
+
+int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Load generator: every patient reports once per second, spread evenly over
+// the second; 1% of them are deteriorating and raise alerts. Reports the
+// latency from sample ingest to detection as the population grows.
+void run_load_benchmark() {
+    static const uint32_t populations[] = {1000, 10000, 50000, 100000};
+    const int slices = 100; // Ingest slots per second
+
+    for (size_t p = 0; p < sizeof(populations) / sizeof(populations[0]); p++) {
+        uint32_t patients = populations[p];
+        size_t max_latencies = (size_t)patients * BENCH_SECONDS;
+        uint32_t *latencies = malloc(max_latencies * sizeof(uint32_t));
+        size_t alerts = 0;
+        if (!latencies || !engine_init(patients)) {
+            free(latencies);
+            return;
+        }
+
+        uint64_t start = monotonic_us();
+        for (int tick = 0; tick < BENCH_SECONDS * slices; tick++) {
+            uint32_t from = (uint32_t)((uint64_t)patients * (tick % slices) / slices);
+            uint32_t to = (uint32_t)((uint64_t)patients * (tick % slices + 1) / slices);
+            int second = tick / slices;
+            for (uint32_t id = from; id < to; id++) {
+                bool sick = id % 100 == 7 && second % 2 == 1;
+                engine_ingest(id, sick ? 135.0f : 70.0f + (float)(id % 10), sick ? 86.0f : 97.0f, 36.8f);
+            }
+            alert_event_t event;
+            while (engine_next_alert(&event)) {
+                if (event.flags && alerts < max_latencies) {
+                    latencies[alerts++] = event.latency_us;
+                }
+            }
+            uint64_t due = start + (uint64_t)(tick + 1) * 1000000 / slices;
+            uint64_t now = monotonic_us();
+            if (due > now) {
+                usleep((useconds_t)(due - now));
+            }
+        }
+        engine_shutdown();
+
+        // Shard threads are joined, so their counters can be read
+        uint64_t dropped = 0, deferred = 0;
+        for (int s = 0; s < ENGINE_SHARDS; s++) {
+            dropped += shards[s].samples_dropped;
+            deferred += shards[s].alerts_deferred;
+        }
+        if (alerts > 0) {
+            qsort(latencies, alerts, sizeof(uint32_t), compare_u32);
+            printf("Patients: %6u, alerts: %6zu, detection latency p50: %6.1f ms, p99: %6.1f ms, max: %6.1f ms, "
+                   "%llu samples dropped, %llu alerts deferred\n",
+                   patients, alerts, latencies[alerts / 2] / 1000.0, latencies[alerts * 99 / 100] / 1000.0,
+                   latencies[alerts - 1] / 1000.0, (unsigned long long)dropped, (unsigned long long)deferred);
+        } else {
+            printf("Patients: %6u, no alerts raised, %llu samples dropped, %llu alerts deferred\n", patients,
+                   (unsigned long long)dropped, (unsigned long long)deferred);
+        }
+        free(latencies);
+    }
+}
+
+uint8_t *put_uvarint(uint8_t *p, uint32_t value) {
+    while (value >= 0x80) {
+        *p++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+uint8_t *put_varint(uint8_t *p, int32_t value) {
+    return put_uvarint(p, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+// Window layout: "HT" v1, uvarint patient, u32 start time, uvarint count, then
+// per record the zigzag varint delta of every field against the previous one,
+// and the AI report (uvarint length + text) only when it changed
+size_t encode_vitals_batch(const vitals_batch_t *batch, uint32_t patient, uint8_t *out) {
+    static char last_report[sizeof(health_report)];
+    vitals_record_t prev = {batch->start_s, 0, 0, 0, 0, 0};
+    uint8_t *p = out;
+
+    *p++ = 'H';
+    *p++ = 'T';
+    *p++ = 1;
+    p = put_uvarint(p, patient);
+    memcpy(p, &batch->start_s, 4);
+    p += 4;
+    p = put_uvarint(p, batch->count);
+    for (uint32_t i = 0; i < batch->count; i++) {
+        const vitals_record_t *r = &batch->records[i];
+        p = put_varint(p, (int32_t)(r->t_s - prev.t_s));
+        p = put_varint(p, r->heart_rate - prev.heart_rate);
+        p = put_varint(p, r->spo2 - prev.spo2);
+        p = put_varint(p, r->temp_dc - prev.temp_dc);
+        p = put_varint(p, r->rr_ms - prev.rr_ms);
+        p = put_varint(p, r->flags - prev.flags);
+        prev = *r;
+    }
+    bool changed = strcmp(batch->report, last_report) != 0;
+    size_t len = changed ? strlen(batch->report) : 0;
+    p = put_uvarint(p, (uint32_t)len);
+    memcpy(p, batch->report, len);
+    p += len;
+    strcpy(last_report, batch->report);
+    return (size_t)(p - out);
+}
+
+size_t base64_encode(const uint8_t *in, size_t len, char *out) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t n = 0;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)in[i] << 16;
+        if (i + 1 < len) v |= (uint32_t)in[i + 1] << 8;
+        if (i + 2 < len) v |= in[i + 2];
+        out[n++] = table[(v >> 18) & 63];
+        out[n++] = table[(v >> 12) & 63];
+        out[n++] = i + 1 < len ? table[(v >> 6) & 63] : '=';
+        out[n++] = i + 2 < len ? table[v & 63] : '=';
+    }
+    out[n] = '\0';
+    return n;
+}
+
+uint32_t crc32(const uint8_t *data, size_t len) {
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+// One encoded message goes to every sink. The Wi-Fi post decides whether we
+// are online; the cloud upload rides the same link, Bluetooth is best effort.
+bool upload_message(const char *message) {
+    if (!wifi_send_data(HEALTH_API_URL, message)) {
+        return false;
+    }
+    upload_health_data(message);
+    bluetooth_send(message);
+    upload_wire_bytes += strlen(message);
+    return true;
+}
+
+// Offline log entries are [u32 length][u32 crc32][message]. Each append is
+// fsync'd; a torn final entry is cut off on the next start. upload_log_acked
+// (persisted via rename) marks how far a replay got, so entries are delivered
+// at least once across crashes.
+void upload_log_append(const char *message) {
+    uint32_t header[2] = {(uint32_t)strlen(message), crc32((const uint8_t *)message, strlen(message))};
+    if (write(upload_log_fd, header, sizeof(header)) != sizeof(header)
+        || write(upload_log_fd, message, header[0]) != (ssize_t)header[0] || fsync(upload_log_fd) != 0) {
+        printf("[WARN] Could not persist telemetry window.\n");
+        return;
+    }
+    upload_windows_logged++;
+}
+
+void upload_log_save_ack(long offset) {
+    FILE *ack = fopen(UPLOAD_ACK_PATH ".tmp", "w");
+    if (!ack) {
+        return;
+    }
+    fprintf(ack, "%ld\n", offset);
+    fflush(ack);
+    fsync(fileno(ack));
+    fclose(ack);
+    rename(UPLOAD_ACK_PATH ".tmp", UPLOAD_ACK_PATH);
+    upload_log_acked = offset;
+}
+
+void upload_log_open() {
+    static char message[UPLOAD_MESSAGE_MAX];
+    uint32_t header[2];
+    long valid = 0;
+
+    upload_log_fd = open(UPLOAD_LOG_PATH, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (upload_log_fd < 0) {
+        printf("[WARN] Offline telemetry log unavailable.\n");
+        return;
+    }
+    FILE *log = fdopen(dup(upload_log_fd), "rb");
+    while (log && fread(header, sizeof(header), 1, log) == 1 && header[0] < sizeof(message)
+           && fread(message, 1, header[0], log) == header[0] && crc32((uint8_t *)message, header[0]) == header[1]) {
+        valid = ftell(log);
+    }
+    if (log) {
+        fclose(log);
+    }
+    if (ftruncate(upload_log_fd, valid) != 0) {
+        printf("[WARN] Could not trim offline telemetry log.\n");
+    }
+
+    FILE *ack = fopen(UPLOAD_ACK_PATH, "r");
+    upload_log_acked = 0;
+    if (ack) {
+        if (fscanf(ack, "%ld", &upload_log_acked) != 1 || upload_log_acked > valid) {
+            upload_log_acked = 0;
+        }
+        fclose(ack);
+    }
+    upload_log_pending = valid > upload_log_acked;
+}
+
+// Resends logged windows in order; stops at the first refusal
+void upload_log_replay() {
+    static char message[UPLOAD_MESSAGE_MAX + 1];
+    uint32_t header[2];
+    FILE *log = fdopen(dup(upload_log_fd), "rb");
+    if (!log) {
+        return;
+    }
+    fseek(log, upload_log_acked, SEEK_SET);
+    while (fread(header, sizeof(header), 1, log) == 1 && header[0] < sizeof(message)
+           && fread(message, 1, header[0], log) == header[0]) {
+        message[header[0]] = '\0';
+        if (!upload_message(message)) {
+            fclose(log);
+            return;
+        }
+        upload_log_save_ack(ftell(log));
+    }
+    fclose(log);
+    if (ftruncate(upload_log_fd, 0) == 0) {
+        upload_log_save_ack(0);
+        upload_log_pending = false;
+    }
+}
+
+void *upload_thread(void *arg) {
+    static uint8_t encoded[UPLOAD_ENCODED_MAX];
+    static char message[UPLOAD_MESSAGE_MAX];
+    vitals_batch_t batch;
+    (void)arg;
+
+    while (1) {
+        pthread_mutex_lock(&upload_lock);
+        while (upload_tail == upload_head) {
+            pthread_cond_wait(&upload_ready, &upload_lock);
+        }
+        batch = upload_batches[upload_tail % UPLOAD_QUEUE];
+        upload_tail++;
+        pthread_mutex_unlock(&upload_lock);
+
+        size_t len = encode_vitals_batch(&batch, LOCAL_PATIENT, encoded);
+        upload_encoded_bytes += len;
+        memcpy(message, "HT1:", 4);
+        base64_encode(encoded, len, message + 4);
+
+        if (upload_log_pending) {
+            upload_log_replay();
+        }
+        if (upload_log_pending || !upload_message(message)) {
+            // Keep ordering: once anything is logged, new windows queue behind it
+            upload_log_append(message);
+            upload_log_pending = true;
+        }
+    }
+    return NULL;
+}
+
+void bits_write(uint8_t *data, uint32_t *pos, uint64_t value, int nbits) {
+    for (int i = nbits - 1; i >= 0; i--) {
+        uint32_t p = (*pos)++;
+        if ((value >> i) & 1) {
+            data[p >> 3] |= (uint8_t)(0x80 >> (p & 7));
+        }
+    }
+}
+
+uint64_t bits_read(const uint8_t *data, uint32_t *pos, int nbits) {
+    uint64_t value = 0;
+    for (int i = 0; i < nbits; i++) {
+        uint32_t p = (*pos)++;
+        value = (value << 1) | ((data[p >> 3] >> (7 - (p & 7))) & 1);
+    }
+    return value;
+}
+
+uint64_t double_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+double bits_double(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Worst case for one sample: 4 + 32 timestamp bits, 2 + 5 + 6 + 64 value bits
+#define TSDB_MAX_SAMPLE_BITS 113
+
+void tsdb_start_block(tsdb_series_t *series, int64_t t_ms, double value) {
+    tsdb_block_t *block = &series->blocks[series->current];
+    memset(block, 0, sizeof(*block));
+    block->header.magic = TSDB_MAGIC;
+    block->header.start_ms = t_ms;
+    block->header.end_ms = t_ms;
+    block->header.first_value = value;
+    block->header.count = 1;
+    block->header.min = value;
+    block->header.max = value;
+    block->header.sum = value;
+    series->prev_ms = t_ms;
+    series->prev_delta = 0;
+    series->prev_value = double_bits(value);
+    series->prev_leading = 0xff; // Forces an explicit window on the first change
+    series->prev_trailing = 0;
+}
+
+// Gorilla encoding: delta-of-delta timestamps in variable-width buckets and the
+// XOR of each value with its predecessor, reusing the previous leading/trailing
+// zero window when the new meaningful bits fit inside it
+void tsdb_append(tsdb_series_t *series, int64_t t_ms, double value) {
+    if (!series->blocks) {
+        series->dropped++;
+        return;
+    }
+    tsdb_block_t *block = &series->blocks[series->current];
+
+    if (block->header.magic != TSDB_MAGIC || block->header.count == 0) {
+        tsdb_start_block(series, t_ms, value);
+    } else if (t_ms <= series->prev_ms) {
+        return; // Out of order; the store is append-only
+    } else if (block->header.bits + TSDB_MAX_SAMPLE_BITS > TSDB_PAYLOAD_BITS) {
+        msync(block, sizeof(*block), MS_ASYNC);
+        series->current = (series->current + 1) % TSDB_BLOCKS;
+        tsdb_start_block(series, t_ms, value); // Overwrites the oldest block
+    } else {
+        uint8_t *data = block->payload;
+        uint32_t *pos = &block->header.bits;
+        int64_t delta = t_ms - series->prev_ms;
+        int64_t dod = delta - series->prev_delta;
+
+        if (dod == 0) {
+            bits_write(data, pos, 0, 1);
+        } else if (dod >= -63 && dod <= 64) {
+            bits_write(data, pos, 0x2, 2);
+            bits_write(data, pos, (uint64_t)(dod + 63), 7);
+        } else if (dod >= -255 && dod <= 256) {
+            bits_write(data, pos, 0x6, 3);
+            bits_write(data, pos, (uint64_t)(dod + 255), 9);
+        } else if (dod >= -2047 && dod <= 2048) {
+            bits_write(data, pos, 0xe, 4);
+            bits_write(data, pos, (uint64_t)(dod + 2047), 12);
+        } else {
+            bits_write(data, pos, 0xf, 4);
+            bits_write(data, pos, (uint64_t)(uint32_t)dod, 32);
+        }
+
+        uint64_t current = double_bits(value);
+        uint64_t x = current ^ series->prev_value;
+        if (x == 0) {
+            bits_write(data, pos, 0, 1);
+        } else {
+            int leading = __builtin_clzll(x);
+            int trailing = __builtin_ctzll(x);
+            leading = leading > 31 ? 31 : leading;
+            if (series->prev_leading != 0xff && leading >= series->prev_leading && trailing >= series->prev_trailing) {
+                bits_write(data, pos, 0x2, 2);
+                bits_write(data, pos, x >> series->prev_trailing, 64 - series->prev_leading - series->prev_trailing);
+            } else {
+                int length = 64 - leading - trailing;
+                bits_write(data, pos, 0x3, 2);
+                bits_write(data, pos, (uint64_t)leading, 5);
+                bits_write(data, pos, (uint64_t)(length - 1), 6);
+                bits_write(data, pos, x >> trailing, length);
+                series->prev_leading = (uint8_t)leading;
+                series->prev_trailing = (uint8_t)trailing;
+            }
+        }
+
+        series->prev_delta = delta;
+        series->prev_ms = t_ms;
+        series->prev_value = current;
+        block->header.end_ms = t_ms;
+        block->header.count++;
+        block->header.min = value < block->header.min ? value : block->header.min;
+        block->header.max = value > block->header.max ? value : block->header.max;
+        block->header.sum += value;
+    }
+    tsdb_rollup_add(series->minutes, TSDB_MINUTE_SLOTS, 60000, t_ms, value);
+    tsdb_rollup_add(series->hours, TSDB_HOUR_SLOTS, 3600000, t_ms, value);
+}
+
+void tsdb_rollup_add(tsdb_rollup_t *slots, int num_slots, int64_t period_ms, int64_t t_ms, double value) {
+    int64_t bucket = t_ms / period_ms;
+    tsdb_rollup_t *slot = &slots[bucket % num_slots];
+    if (slot->bucket != bucket || slot->count == 0) {
+        slot->bucket = bucket;
+        slot->count = 0;
+        slot->min = value;
+        slot->max = value;
+        slot->sum = 0.0;
+    }
+    slot->count++;
+    slot->min = value < slot->min ? value : slot->min;
+    slot->max = value > slot->max ? value : slot->max;
+    slot->sum += value;
+}
+
+// Decodes a whole block; calls emit for each sample and, when resuming a
+// series, leaves the encoder state at the last sample
+uint32_t tsdb_decode_block(const tsdb_block_t *block, tsdb_series_t *resume,
+                           void (*emit)(void *ctx, int64_t t_ms, double value), void *ctx) {
+    const uint8_t *data = block->payload;
+    uint32_t pos = 0;
+    int64_t t = block->header.start_ms, delta = 0;
+    uint64_t value = double_bits(block->header.first_value);
+    int leading = 0xff, trailing = 0;
+
+    if (emit) {
+        emit(ctx, t, block->header.first_value);
+    }
+    for (uint32_t n = 1; n < block->header.count; n++) {
+        int64_t dod;
+        if (bits_read(data, &pos, 1) == 0) {
+            dod = 0;
+        } else if (bits_read(data, &pos, 1) == 0) {
+            dod = (int64_t)bits_read(data, &pos, 7) - 63;
+        } else if (bits_read(data, &pos, 1) == 0) {
+            dod = (int64_t)bits_read(data, &pos, 9) - 255;
+        } else if (bits_read(data, &pos, 1) == 0) {
+            dod = (int64_t)bits_read(data, &pos, 12) - 2047;
+        } else {
+            dod = (int32_t)bits_read(data, &pos, 32);
+        }
+        delta += dod;
+        t += delta;
+
+        if (bits_read(data, &pos, 1) == 1) {
+            if (bits_read(data, &pos, 1) == 1) {
+                leading = (int)bits_read(data, &pos, 5);
+                int length = (int)bits_read(data, &pos, 6) + 1;
+                trailing = 64 - leading - length;
+            }
+            value ^= bits_read(data, &pos, 64 - leading - trailing) << trailing;
+        }
+        if (emit) {
+            emit(ctx, t, bits_double(value));
+        }
+    }
+    if (resume) {
+        resume->prev_ms = t;
+        resume->prev_delta = delta;
+        resume->prev_value = value;
+        resume->prev_leading = (uint8_t)leading;
+        resume->prev_trailing = (uint8_t)trailing;
+    }
+    return block->header.count;
+}
+
+void tsdb_rebuild_rollup(void *ctx, int64_t t_ms, double value) {
+    tsdb_series_t *series = ctx;
+    tsdb_rollup_add(series->minutes, TSDB_MINUTE_SLOTS, 60000, t_ms, value);
+    tsdb_rollup_add(series->hours, TSDB_HOUR_SLOTS, 3600000, t_ms, value);
+}
+
+// Maps (creating if needed) the series' ring of blocks, then resumes the
+// newest block and rebuilds the in-memory rollups from what is on disk
+bool tsdb_open(tsdb_series_t *series, const char *path) {
+    memset(series, 0, sizeof(*series));
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)sizeof(tsdb_block_t) * TSDB_BLOCKS) != 0) {
+        printf("[WARN] Cannot open history store %s.\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    series->blocks = mmap(NULL, sizeof(tsdb_block_t) * TSDB_BLOCKS, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (series->blocks == MAP_FAILED) {
+        printf("[WARN] Cannot map history store %s.\n", path);
+        series->blocks = NULL;
+        return false;
+    }
+    series->minutes = calloc(TSDB_MINUTE_SLOTS, sizeof(tsdb_rollup_t));
+    series->hours = calloc(TSDB_HOUR_SLOTS, sizeof(tsdb_rollup_t));
+    if (!series->minutes || !series->hours) {
+        printf("[WARN] Out of memory for %s rollups.\n", path);
+        munmap(series->blocks, sizeof(tsdb_block_t) * TSDB_BLOCKS);
+        free(series->minutes);
+        free(series->hours);
+        memset(series, 0, sizeof(*series)); // Not open: appends are dropped
+        return false;
+    }
+
+    int64_t newest = INT64_MIN;
+    for (int i = 0; i < TSDB_BLOCKS; i++) {
+        const tsdb_block_t *block = &series->blocks[i];
+        if (block->header.magic == TSDB_MAGIC && block->header.count && block->header.start_ms > newest) {
+            newest = block->header.start_ms;
+            series->current = i;
+        }
+    }
+    if (newest == INT64_MIN) {
+        return true;
+    }
+    // Oldest block is the one after the newest in ring order
+    for (int n = 1; n <= TSDB_BLOCKS; n++) {
+        int i = (series->current + n) % TSDB_BLOCKS;
+        const tsdb_block_t *block = &series->blocks[i];
+        if (block->header.magic == TSDB_MAGIC && block->header.count) {
+            tsdb_decode_block(block, i == series->current ? series : NULL, tsdb_rebuild_rollup, series);
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    int64_t from_ms, to_ms;
+    tsdb_aggregate_t *agg;
+} tsdb_range_ctx_t;
+
+void tsdb_aggregate_sample(void *ctx, int64_t t_ms, double value) {
+    tsdb_range_ctx_t *range = ctx;
+    if (t_ms >= range->from_ms && t_ms < range->to_ms) {
+        tsdb_aggregate_t *agg = range->agg;
+        agg->min = agg->count == 0 || value < agg->min ? value : agg->min;
+        agg->max = agg->count == 0 || value > agg->max ? value : agg->max;
+        agg->sum += value;
+        agg->count++;
+    }
+}
+
+// Exact aggregate over [from, to): blocks entirely inside the range answer from
+// their header, only the boundary blocks are decoded
+void tsdb_aggregate(const tsdb_series_t *series, int64_t from_ms, int64_t to_ms, tsdb_aggregate_t *agg) {
+    tsdb_range_ctx_t range = {from_ms, to_ms, agg};
+    memset(agg, 0, sizeof(*agg));
+    for (int i = 0; i < TSDB_BLOCKS && series->blocks; i++) {
+        const tsdb_block_header_t *header = &series->blocks[i].header;
+        if (header->magic != TSDB_MAGIC || header->count == 0 || header->end_ms < from_ms || header->start_ms >= to_ms) {
+            continue;
+        }
+        if (header->start_ms >= from_ms && header->end_ms < to_ms) {
+            agg->min = agg->count == 0 || header->min < agg->min ? header->min : agg->min;
+            agg->max = agg->count == 0 || header->max > agg->max ? header->max : agg->max;
+            agg->sum += header->sum;
+            agg->count += header->count;
+        } else {
+            tsdb_decode_block(&series->blocks[i], NULL, tsdb_aggregate_sample, &range);
+        }
+    }
+}
+
+// Aggregate from the minute or hour rollups; the range is widened to whole buckets
+void tsdb_rollup_aggregate(const tsdb_series_t *series, int64_t from_ms, int64_t to_ms, bool hourly, tsdb_aggregate_t *agg) {
+    const tsdb_rollup_t *slots = hourly ? series->hours : series->minutes;
+    int num_slots = hourly ? TSDB_HOUR_SLOTS : TSDB_MINUTE_SLOTS;
+    int64_t period = hourly ? 3600000 : 60000;
+    memset(agg, 0, sizeof(*agg));
+    if (!slots) {
+        return;
+    }
+    for (int64_t bucket = from_ms / period; bucket <= (to_ms - 1) / period; bucket++) {
+        const tsdb_rollup_t *slot = &slots[bucket % num_slots];
+        if (slot->bucket != bucket || slot->count == 0) {
+            continue;
+        }
+        agg->min = agg->count == 0 || slot->min < agg->min ? slot->min : agg->min;
+        agg->max = agg->count == 0 || slot->max > agg->max ? slot->max : agg->max;
+        agg->sum += slot->sum;
+        agg->count += slot->count;
+    }
+}
+
+int64_t wall_clock_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void store_vitals_history() {
+    int64_t now = wall_clock_ms();
+    tsdb_append(&vitals_history[SERIES_HEART_RATE], now, heart_rate);
+    tsdb_append(&vitals_history[SERIES_SPO2], now, spo2);
+    tsdb_append(&vitals_history[SERIES_TEMPERATURE], now, body_temperature);
+    tsdb_append(&vitals_history[SERIES_RR_INTERVAL], now, rr_interval_ms);
+    for (int s = 0; s < NUM_SERIES; s++) {
+        if (vitals_history[s].dropped % TSDB_DROP_REPORT == 1) {
+            printf("[WARN] %s history: %llu samples dropped\n", series_names[s], (unsigned long long)vitals_history[s].dropped);
+        }
+    }
+}
+
+// Ingests a week of 1 Hz synthetic vitals into fresh stores, then times exact
+// (block) and rollup aggregate queries over the last 6 hours
+void run_history_benchmark() {
+    const int64_t days = 7, samples = days * 86400;
+    const int64_t start_ms = 1700000000000LL;
+    struct timespec t0, t1;
+    tsdb_aggregate_t agg;
+
+    for (int s = 0; s < NUM_SERIES; s++) {
+        char path[64];
+        sprintf(path, "bench_%s.tsdb", series_names[s]);
+        unlink(path);
+        if (!tsdb_open(&vitals_history[s], path)) {
+            return;
+        }
+    }
+    srand(1);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int64_t n = 0; n < samples; n++) {
+        int64_t t = start_ms + n * 1000;
+        int hr = 70 + (int)(10 * sin(n / 3600.0)) + rand() % 3;
+        tsdb_append(&vitals_history[SERIES_HEART_RATE], t, hr);
+        tsdb_append(&vitals_history[SERIES_SPO2], t, 96 + rand() % 3);
+        tsdb_append(&vitals_history[SERIES_TEMPERATURE], t, 36.5f + (float)(rand() % 5) / 10.0f);
+        tsdb_append(&vitals_history[SERIES_RR_INTERVAL], t, 60000 / hr);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ingest_s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+
+    for (int s = 0; s < NUM_SERIES; s++) {
+        uint64_t bits = 0, count = 0;
+        for (int i = 0; i < TSDB_BLOCKS; i++) {
+            if (vitals_history[s].blocks[i].header.magic == TSDB_MAGIC) {
+                bits += vitals_history[s].blocks[i].header.bits + 8 * sizeof(tsdb_block_header_t);
+                count += vitals_history[s].blocks[i].header.count;
+            }
+        }
+        printf("Series %-11s %8llu samples, %.2f bytes/sample\n", series_names[s], (unsigned long long)count, bits / 8.0 / count);
+    }
+    printf("Ingest: %.1f M samples/s over %lld days\n", samples * NUM_SERIES / ingest_s / 1e6, (long long)days);
+
+    const int64_t end_ms = start_ms + samples * 1000;
+    const int64_t from_ms = end_ms - 6 * 3600000LL;
+    const int runs = 200;
+    for (int mode = 0; mode < 3; mode++) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int r = 0; r < runs; r++) {
+            if (mode == 0) {
+                tsdb_aggregate(&vitals_history[SERIES_SPO2], from_ms + r, end_ms, &agg);
+            } else {
+                tsdb_rollup_aggregate(&vitals_history[SERIES_SPO2], from_ms, end_ms, mode == 2, &agg);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double us = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / 1000.0 / runs;
+        printf("SpO2 last 6 h via %-13s avg %.2f%%, min %.0f%%, %llu samples: %.1f us/query\n",
+               mode == 0 ? "blocks" : mode == 1 ? "minute rollup" : "hour rollup",
+               agg.count ? agg.sum / agg.count : 0.0, agg.min, (unsigned long long)agg.count, us);
+    }
+}
@@ -1,21 +1,94 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include "wifi_module.h"  // Simulated Wi-Fi library
 #include "sensor_module.h" // Simulated sensor library
 #include "relay_control.h" // Simulated relay control for appliances
 #include "lcd_display.h"   // Simulated LCD Display library
 #include "security_module.h" // Simulated Security System
+#include "rule_engine.h"     // Table-driven threshold rules
+#include "telemetry_encoder.h" // Schema-driven JSON/CBOR batching
 
-#define TEMP_THRESHOLD 30
-#define GAS_THRESHOLD 200
+#define RULES_PATH "smarthome.rules"
+#define CLOUD_URL "http://iot-cloud.com/api/data"
+#define PUBLISH_INTERVAL_MS 10000  // One cloud message per interval
+#define BROKER_BENCH_PORT 18830
+
+#define MAX_DEVICES 32
+#define TEMP_SAMPLE_MS 1000    // Temperature drifts slowly
+#define GAS_SAMPLE_MS 200
+#define MOTION_SAMPLE_MS 50    // Bounds motion-to-light delay
+#define CLOUD_INTERVAL_MS 2000  // Snapshot for the cloud and LCD refresh
+#define STATS_INTERVAL_MS 60000
+#define RULES_CHECK_MS 1000    // Rule file hot-reload check
+#define POLL_INTERVAL_S 2      // Legacy polling loop period
+
+typedef enum {
+    SENSOR_TEMPERATURE,
+    SENSOR_GAS,
+    SENSOR_MOTION,
+    NUM_SENSORS
+} sensor_id_t;
+
+// Reactor timers that are not sensors use tokens after the sensor IDs
+#define TIMER_CLOUD NUM_SENSORS
+#define TIMER_STATS (NUM_SENSORS + 1)
+#define TIMER_RULES (NUM_SENSORS + 2)
+#define NUM_TIMERS (NUM_SENSORS + 3)
+
+#define CHANGED(sensor) (1u << (sensor))
+#define CHANGED_ALL ((1u << NUM_SENSORS) - 1)
+
+#define HOME_READING_FIELDS(FIELD, R) \
+    FIELD(R, temp, uint16_t, FIELD_UINT) \
+    FIELD(R, gas, uint16_t, FIELD_UINT) \
+    FIELD(R, motion, bool, FIELD_BOOL) \
+    FIELD(R, light, bool, FIELD_BOOL) \
+    FIELD(R, door_locked, bool, FIELD_BOOL)
+DEFINE_SCHEMA(home_reading, HOME_READING_FIELDS);
+
+typedef struct {
+    const char *name;
+    uint32_t interval_ms;
+    uint16_t value;
+    bool valid;               // False until the first sample
+    uint64_t sampled_ns;      // When the current value was read
+    uint32_t samples, changes;
+} sensor_source_t;
+
+// Appliances are interned once at startup; everything after that uses the index
+typedef struct {
+    const char *name;
+    bool known;               // Relay state is unknown until the first command
+    bool on;
+    uint32_t commands;
+    uint32_t suppressed;      // Requests that matched the current state
+    uint64_t latency_total_ns, latency_max_ns;
+} device_t;
 
 void init_system();
 void read_sensors();
-void control_appliances();
+void control_appliances(uint32_t changed);
 void send_data_to_cloud();
 void display_status_on_lcd();
-void security_system_check();
+void security_system_check(uint64_t event_ns);
+int device_intern(const char *name);
+int rule_output_device(int output);
+void relay_set(int device, bool on, uint64_t event_ns);
+bool sample_sensor(int sensor);
+int arm_timer(int epoll_fd, int token, uint32_t interval_ms);
+void run_reactor();
+void run_polling_loop();
+void print_actuation_stats();
+uint64_t monotonic_ns();
+void on_rule_output(rule_engine_t *engine, int output, bool on, void *ctx);
+bool cloud_sink(const uint8_t *data, size_t len, void *ctx);
+void run_encode_benchmark();
 
 uint16_t temperature = 0;
 uint16_t gas_level = 0;
@@ -23,18 +96,151 @@ bool motion_detected = false;
 bool light_status = false;
 bool door_locked = true;
 
-int main() {
+sensor_source_t sensors[NUM_SENSORS] = {
+    [SENSOR_TEMPERATURE] = {"Temperature", TEMP_SAMPLE_MS},
+    [SENSOR_GAS] = {"Gas", GAS_SAMPLE_MS},
+    [SENSOR_MOTION] = {"Motion", MOTION_SAMPLE_MS},
+};
+const char *sensor_inputs[NUM_SENSORS] = {"temperature", "gas", "motion"};
+
+// Used when smarthome.rules does not exist
+const char *default_rules =
+    "temperature > 30 hysteresis 1 debounce 5000 -> Fan\n"
+    "gas > 200 hysteresis 20 -> Exhaust\n"
+    "motion > 0 -> Light\n";
+
+rule_engine_t rules;
+int rule_inputs[NUM_SENSORS];
+
+device_t devices[MAX_DEVICES];
+int num_devices = 0;
+int dev_fan, dev_exhaust, dev_light, dev_door_lock;
+// Rule output index -> device, so transitions skip the name lookup. Output
+// indices are stable across reloads; new ones are added at the end.
+uint8_t output_devices[RULE_MAX_NAMES];
+uint32_t num_output_devices = 0;
+bool diff_actuation = true;  // Off in the legacy loop to reproduce its relay traffic
+
+publisher_t cloud_publisher;
+
+// Usage: smarthome                event-driven reactor
+//        smarthome poll           original 2 s polling loop, for comparison
+//        smarthome encode-bench   telemetry encoder and publish benchmark
+int main(int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "encode-bench") == 0) {
+        run_encode_benchmark();
+        return 0;
+    }
     init_system();
-    
+
+    if (argc >= 2 && strcmp(argv[1], "poll") == 0) {
+        diff_actuation = false;
+        run_polling_loop();
+    } else {
+        run_reactor();
+    }
+    return 0;
+}
+
+void run_polling_loop() {
+    uint64_t last_stats = monotonic_ns();
+
     while (1) {
         read_sensors();
-        control_appliances();
-        security_system_check();
+        control_appliances(CHANGED_ALL);
+        security_system_check(sensors[SENSOR_MOTION].sampled_ns);
         send_data_to_cloud();
         display_status_on_lcd();
-        sleep(2);  // Delay for 2 seconds
+        if (monotonic_ns() - last_stats >= (uint64_t)STATS_INTERVAL_MS * 1000000) {
+            print_actuation_stats();
+            last_stats = monotonic_ns();
+        }
+        sleep(POLL_INTERVAL_S);
     }
-    return 0;
+}
+
+// Every sensor and periodic job is a timerfd on one epoll set, so each sensor
+// is sampled at its own rate and a change is acted on as soon as it is seen
+// instead of waiting for the next pass of a fixed-period loop
+void run_reactor() {
+    int epoll_fd = epoll_create1(0);
+    int timer_fds[NUM_TIMERS];
+
+    if (epoll_fd < 0) {
+        printf("[ERROR] epoll unavailable, falling back to polling.\n");
+        run_polling_loop();
+        return;
+    }
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        timer_fds[i] = arm_timer(epoll_fd, i, sensors[i].interval_ms);
+    }
+    timer_fds[TIMER_CLOUD] = arm_timer(epoll_fd, TIMER_CLOUD, CLOUD_INTERVAL_MS);
+    timer_fds[TIMER_STATS] = arm_timer(epoll_fd, TIMER_STATS, STATS_INTERVAL_MS);
+    timer_fds[TIMER_RULES] = arm_timer(epoll_fd, TIMER_RULES, RULES_CHECK_MS);
+    for (int i = 0; i < NUM_TIMERS; i++) {
+        if (timer_fds[i] < 0) {
+            printf("[ERROR] Timer %d could not be armed, falling back to polling.\n", i);
+            for (int j = 0; j < NUM_TIMERS; j++) {
+                if (timer_fds[j] >= 0) {
+                    close(timer_fds[j]);
+                }
+            }
+            close(epoll_fd);
+            run_polling_loop();
+            return;
+        }
+    }
+
+    while (1) {
+        struct epoll_event events[NUM_TIMERS];
+        int ready = epoll_wait(epoll_fd, events, NUM_TIMERS, -1);
+        uint32_t changed = 0;
+
+        for (int e = 0; e < ready; e++) {
+            int token = (int)events[e].data.u32;
+            uint64_t expirations;
+            if (read(timer_fds[token], &expirations, sizeof(expirations)) != sizeof(expirations)) {
+                continue;
+            }
+            if (token < NUM_SENSORS) {
+                if (sample_sensor(token)) {
+                    changed |= CHANGED(token);
+                }
+            } else if (token == TIMER_CLOUD) {
+                send_data_to_cloud();
+                display_status_on_lcd();
+            } else if (token == TIMER_STATS) {
+                print_actuation_stats();
+            } else if (token == TIMER_RULES) {
+                rule_engine_reload_if_changed(&rules);
+            }
+        }
+        control_appliances(changed);  // Also completes expired debounces
+        if (changed) {
+            if (changed & CHANGED(SENSOR_MOTION)) {
+                security_system_check(sensors[SENSOR_MOTION].sampled_ns);
+            }
+            send_data_to_cloud();
+        }
+    }
+}
+
+int arm_timer(int epoll_fd, int token, uint32_t interval_ms) {
+    struct itimerspec spec = {
+        .it_interval = {interval_ms / 1000, (interval_ms % 1000) * 1000000L},
+        .it_value = {0, 1},  // First expiry right away
+    };
+    struct epoll_event event = {.events = EPOLLIN, .data.u32 = (uint32_t)token};
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (timerfd_settime(fd, 0, &spec, NULL) != 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
 }
 
 void init_system() {
@@ -44,42 +250,177 @@ void init_system() {
     relay_init();
     lcd_init();
     security_init();
+
+    dev_fan = device_intern("Fan");
+    dev_exhaust = device_intern("Exhaust");
+    dev_light = device_intern("Light");
+    dev_door_lock = device_intern("Door Lock");
+
+    rule_engine_init(&rules, on_rule_output, RULE_MAX_NAMES);
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        rule_inputs[i] = rule_engine_input(&rules, sensor_inputs[i]);
+    }
+    rule_engine_load(&rules, RULES_PATH, default_rules);
+
+    publisher_start(&cloud_publisher, &home_reading_schema, ENCODE_JSON, PUBLISH_INTERVAL_MS, cloud_sink, NULL);
 }
 
-void read_sensors() {
-    temperature = read_temperature_sensor();
-    gas_level = read_gas_sensor();
-    motion_detected = read_motion_sensor();
-    printf("Sensors - Temp: %d°C, Gas: %d ppm, Motion: %s\n", temperature, gas_level, motion_detected ? "YES" : "NO");
+// Rule outputs are appliance names; ctx is the triggering sample's read time
+void on_rule_output(rule_engine_t *engine, int output, bool on, void *ctx) {
+    (void)engine;
+    int device = rule_output_device(output);
+    if (device == dev_light) {
+        light_status = on;
+    }
+    if (diff_actuation) {
+        relay_set(device, on, ctx ? *(uint64_t *)ctx : monotonic_ns());
+    }
 }
 
-void control_appliances() {
-    if (temperature > TEMP_THRESHOLD) {
-        relay_turn_on("Fan");
-    } else {
-        relay_turn_off("Fan");
+// A load or reload that adds outputs reports each of them once, so the table
+// is extended there and every later transition is a plain index
+int rule_output_device(int output) {
+    if ((uint32_t)output >= num_output_devices) {
+        for (; num_output_devices < rules.outputs.count; num_output_devices++) {
+            output_devices[num_output_devices] = (uint8_t)device_intern(rule_engine_output_name(&rules, (int)num_output_devices));
+        }
     }
-    
-    if (gas_level > GAS_THRESHOLD) {
-        relay_turn_on("Exhaust");
-    } else {
-        relay_turn_off("Exhaust");
+    return output_devices[output];
+}
+
+int device_intern(const char *name) {
+    for (int i = 0; i < num_devices; i++) {
+        if (strcmp(devices[i].name, name) == 0) {
+            return i;
+        }
+    }
+    if (num_devices == MAX_DEVICES) {
+        printf("[ERROR] Too many devices, cannot register %s.\n", name);
+        return MAX_DEVICES - 1;
     }
-    
-    if (motion_detected) {
-        light_status = true;
-        relay_turn_on("Light");
+    devices[num_devices].name = name;
+    return num_devices++;
+}
+
+// Only real transitions reach the relay driver; event_ns is when the sample
+// that caused this request was read, so latency covers the whole reaction
+void relay_set(int device, bool on, uint64_t event_ns) {
+    device_t *dev = &devices[device];
+
+    if (diff_actuation && dev->known && dev->on == on) {
+        dev->suppressed++;
+        return;
+    }
+    if (on) {
+        relay_turn_on(dev->name);
     } else {
-        light_status = false;
-        relay_turn_off("Light");
+        relay_turn_off(dev->name);
+    }
+    dev->known = true;
+    dev->on = on;
+    dev->commands++;
+
+    uint64_t latency = monotonic_ns() - event_ns;
+    dev->latency_total_ns += latency;
+    if (latency > dev->latency_max_ns) {
+        dev->latency_max_ns = latency;
+    }
+}
+
+// Returns true when the reading differs from the last one
+bool sample_sensor(int sensor) {
+    sensor_source_t *source = &sensors[sensor];
+    uint16_t value;
+
+    switch (sensor) {
+        case SENSOR_TEMPERATURE: value = read_temperature_sensor(); break;
+        case SENSOR_GAS: value = read_gas_sensor(); break;
+        default: value = read_motion_sensor() ? 1 : 0; break;
+    }
+    source->sampled_ns = monotonic_ns();
+    source->samples++;
+    if (source->valid && source->value == value) {
+        return false;
+    }
+    source->valid = true;
+    source->value = value;
+    source->changes++;
+
+    temperature = sensors[SENSOR_TEMPERATURE].value;
+    gas_level = sensors[SENSOR_GAS].value;
+    motion_detected = sensors[SENSOR_MOTION].value != 0;
+    printf("Sensor change - %s: %d\n", source->name, value);
+    return true;
+}
+
+void print_actuation_stats() {
+    printf("Actuation stats (%s):\n", diff_actuation ? "reactor" : "polling");
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        uint32_t interval_ms = diff_actuation ? sensors[i].interval_ms : POLL_INTERVAL_S * 1000;
+        printf("  %-12s samples %7u, changes %5u, worst-case detection delay %u ms\n",
+               sensors[i].name, sensors[i].samples, sensors[i].changes, interval_ms);
+    }
+    for (int i = 0; i < num_devices; i++) {
+        device_t *dev = &devices[i];
+        printf("  %-12s relay commands %5u, suppressed %5u, event-to-relay avg %llu us, max %llu us\n",
+               dev->name, dev->commands, dev->suppressed,
+               dev->commands ? (unsigned long long)(dev->latency_total_ns / dev->commands / 1000) : 0ULL,
+               (unsigned long long)(dev->latency_max_ns / 1000));
+    }
+}
+
+uint64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+void read_sensors() {
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        sample_sensor(i);
+    }
+    printf("Sensors - Temp: %d°C, Gas: %d ppm, Motion: %s\n", temperature, gas_level, motion_detected ? "YES" : "NO");
+}
+
+// changed is a CHANGED() mask; only rules reading those sensors are re-evaluated
+void control_appliances(uint32_t changed) {
+    uint32_t now_ms = (uint32_t)(monotonic_ns() / 1000000);
+
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        if (changed & CHANGED(i)) {
+            rule_engine_update(&rules, rule_inputs[i], sensors[i].value, now_ms, &sensors[i].sampled_ns);
+        }
+    }
+    rule_engine_poll(&rules, now_ms);
+
+    if (!diff_actuation) {
+        // Legacy loop: command every appliance on every pass
+        for (uint32_t output = 0; output < rules.outputs.count; output++) {
+            relay_set(rule_output_device((int)output), rule_engine_output_state(&rules, output),
+                      sensors[SENSOR_TEMPERATURE].sampled_ns);
+        }
     }
 }
 
+// Queues a snapshot; repeats of the previous one are only counted and the
+// publisher thread uploads the interval's records as one message
 void send_data_to_cloud() {
-    char data[150];
-    sprintf(data, "{\"temp\": %d, \"gas\": %d, \"motion\": %d, \"light\": %d, \"door_locked\": %d}", temperature, gas_level, motion_detected, light_status, door_locked);
-    wifi_send_data("http://iot-cloud.com/api/data", data);
-    printf("Data sent to cloud: %s\n", data);
+    home_reading_t reading;
+
+    memset(&reading, 0, sizeof(reading));  // Records are compared bytewise
+    reading.temp = temperature;
+    reading.gas = gas_level;
+    reading.motion = motion_detected;
+    reading.light = light_status;
+    reading.door_locked = door_locked;
+    publisher_submit(&cloud_publisher, &reading);
+}
+
+bool cloud_sink(const uint8_t *data, size_t len, void *ctx) {
+    (void)ctx;
+    bool ok = wifi_send_data(CLOUD_URL, (const char *)data);
+    printf("Data sent to cloud: %zu bytes, %s\n", len, ok ? "ok" : "failed");
+    return ok;
 }
 
 void display_status_on_lcd() {
@@ -88,10 +429,99 @@ void display_status_on_lcd() {
     lcd_display_text(display_msg);
 }
 
-void security_system_check() {
+void security_system_check(uint64_t event_ns) {
     if (motion_detected && !door_locked) {
         printf("[ALERT] Intruder detected! Locking doors...\n");
         door_locked = true;
-        relay_turn_on("Door Lock");
+        relay_set(dev_door_lock, true, event_ns);
+    }
+}
+
+double elapsed_ns(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+// Encodes the same stream of readings with the old sprintf code and with the
+// schema encoder, then measures batched publishes to a local broker stand-in
+void run_encode_benchmark() {
+    static uint8_t out[PUBLISH_MAX_MESSAGE];
+    const int records = 1000000;
+    home_reading_t reading;
+    encode_buf_t buf;
+    struct timespec t0, t1;
+    size_t bytes = 0;
+    char data[150];
+
+    memset(&reading, 0, sizeof(reading));
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < records; i++) {
+        bytes += (size_t)sprintf(data, "{\"temp\": %d, \"gas\": %d, \"motion\": %d, \"light\": %d, \"door_locked\": %d}",
+                                 20 + i % 15, 100 + i % 200, i & 1, i & 2 ? 1 : 0, 1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("sprintf JSON:  %6.1f ns/record, %5.1f bytes/record\n", elapsed_ns(&t0, &t1) / records, (double)bytes / records);
+
+    for (int encoding = ENCODE_JSON; encoding <= ENCODE_CBOR; encoding++) {
+        bytes = 0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int i = 0; i < records; i++) {
+            reading.temp = (uint16_t)(20 + i % 15);
+            reading.gas = (uint16_t)(100 + i % 200);
+            reading.motion = i & 1;
+            reading.light = (i & 2) != 0;
+            reading.door_locked = true;
+            enc_reset(&buf, out, sizeof(out));
+            encode_record(&buf, (encoding_t)encoding, &home_reading_schema, &reading, 0, 1);
+            bytes += buf.len;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        printf("Schema %s:   %6.1f ns/record, %5.1f bytes/record, %.0f MB/s\n", encoding == ENCODE_JSON ? "JSON" : "CBOR",
+               elapsed_ns(&t0, &t1) / records, (double)bytes / records, bytes / (elapsed_ns(&t0, &t1) / 1e9) / 1e6);
+    }
+
+    broker_standin_t broker;
+    broker_client_t client = {BROKER_BENCH_PORT, "home/telemetry", -1};
+    if (!broker_standin_start(&broker, BROKER_BENCH_PORT)) {
+        return;
+    }
+
+    // Raw publish rate: 100-record CBOR batches, each acknowledged by the broker
+    static publish_entry_t entries[100];
+    for (int i = 0; i < 100; i++) {
+        entries[i].ts_ms = publisher_clock_ms();
+        entries[i].repeat = 1;
+        reading.temp = (uint16_t)(20 + i % 15);
+        memcpy(entries[i].record, &reading, sizeof(reading));
+    }
+    cloud_publisher.schema = &home_reading_schema;
+    cloud_publisher.encoding = ENCODE_CBOR;
+    int messages = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    do {
+        size_t len = publisher_encode(&cloud_publisher, entries, 100);
+        if (!broker_publish(&client, cloud_publisher.message, len)) {
+            printf("[ERROR] Broker publish failed.\n");
+            return;
+        }
+        messages++;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+    } while (elapsed_ns(&t0, &t1) < 1e9);
+    printf("Broker publishes: %.0f messages/s, %.0f records/s\n", messages / (elapsed_ns(&t0, &t1) / 1e9),
+           100.0 * messages / (elapsed_ns(&t0, &t1) / 1e9));
+
+    // Coalescing: a control loop submitting every reading, where few change
+    broker_client_t pub_client = {BROKER_BENCH_PORT, "home/telemetry", -1};
+    publisher_start(&cloud_publisher, &home_reading_schema, ENCODE_CBOR, 100, broker_sink, &pub_client);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < records; i++) {
+        reading.temp = (uint16_t)(20 + i / 10000 % 15);
+        publisher_submit(&cloud_publisher, &reading);
     }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    publisher_flush(&cloud_publisher);
+    publisher_stop(&cloud_publisher);
+    printf("Submit: %.1f ns/reading; %llu submitted, %llu coalesced, %llu dropped, %llu messages, %llu bytes published\n",
+           elapsed_ns(&t0, &t1) / records, (unsigned long long)cloud_publisher.submitted,
+           (unsigned long long)cloud_publisher.coalesced, (unsigned long long)cloud_publisher.dropped,
+           (unsigned long long)cloud_publisher.published, (unsigned long long)cloud_publisher.bytes);
 }
@@ -1,6 +1,13 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
 #include "traffic_sensor.h"   // Simulated traffic sensor
 #include "ai_module.h"        // AI-based traffic optimization
 #include "emergency_detector.h" // Emergency vehicle detection
@@ -9,10 +16,158 @@
 #include "gps_module.h"       // GPS tracking for traffic analysis
 #include "mobile_app.h"       // Mobile app integration for manual control
 #include "accident_detector.h" // Real-time accident detection
+#include "detector_ingest.h"   // Detector pulse queue and sliding windows
 
 #define MAX_WAIT_TIME 60  // Maximum wait time at a signal in seconds
 
-void init_system();
+#define CORRIDOR_ROWS 1           // Intersections coordinated from this controller,
+#define CORRIDOR_COLS 1           // laid out as a grid; this one is intersection 0
+#define BLOCK_TRAVEL_S 30.0f      // Travel time between neighbouring intersections
+#define MAX_INTERSECTIONS 4096
+#define NUM_APPROACHES 4          // Indexed by the side traffic arrives from: N, E, S, W
+#define SAT_FLOW_VPH 1800.0f      // Saturation flow per approach
+#define LOST_TIME_S 8             // Amber and all-red per cycle, both phases
+#define MIN_GREEN_S 10            // Pedestrian crossing minimum
+#define CYCLE_MIN_S 40
+#define CYCLE_MAX_S 110           // Longer cycles cannot keep both reds under MAX_WAIT_TIME
+#define OFFSET_STEP_S 2           // Offset search resolution
+#define OFFSET_SWEEPS 3           // Coordinate-descent passes per update
+#define NEIGHBORHOOD_HOPS 2       // Re-optimized around each intersection whose demand changed
+#define DEMAND_CHANGE 0.1f        // Relative change that marks an intersection dirty
+#define DEMAND_FLOOR_VPH 50.0f    // Changes below this are noise on quiet approaches
+#define MAX_COLORS 8
+#define MAX_OPTIMIZER_THREADS 16
+
+#define SIM_RING 64               // Per-link arrival slots, longer than any travel time in seconds
+#define SIM_MAX_THREADS 16
+#define SIM_STRAIGHT_PERCENT 80   // The rest turn left or right in equal shares
+#define SIM_PEAK_ENTRY_VPH 300.0f // Arrivals per edge approach at rush hour, doubled on arterials
+#define SIM_FLOW_TAU_S 60.0f      // Smoothing of the simulated GPS flow
+#define SIM_START_S (7 * 3600)    // Simulated runs start at 07:00
+#define SIM_SEED 1
+#define SIM_MAX_HOURS 8760        // One simulated year
+#define SIM_LOG_PERIOD_S 900      // Status lines every 15 simulated minutes
+#define PLAN_INTERVAL_S 60        // Re-planning period in the simulation benchmark
+
+#define DETECTOR_LANES_PER_APPROACH 4  // Loops or camera zones; lane = approach * 4 + k
+#define DETECTOR_PUBLISH_US 100000     // Windowed values refreshed for the control loop
+#define DETECTOR_IDLE_US 1000          // Ingest thread nap when the queue is empty
+#define SIM_PULSE_ON_US 400000         // Simulated vehicle over a stop-line loop
+#define DENSITY_ZONE_M 60.0f           // Approach length a density reading covers
+#define VEHICLE_EFFECTIVE_M 6.5f       // Vehicle plus loop length, turns occupancy into density
+#define INGEST_BENCH_LANES 1024
+#define INGEST_BENCH_PULSES 50000000
+#define INGEST_BENCH_BATCH 4096
+#define MAX_INGEST_PRODUCERS 8
+
+typedef enum {
+    PLAN_SPLITS,
+    PLAN_OFFSETS
+} plan_job_t;
+
+typedef struct signal_network signal_network_t;
+
+typedef struct {
+    signal_network_t *net;
+    int index;
+} plan_worker_t;
+
+// All intersections of the network in parallel arrays. Neighbours and
+// approaches share the side index: traffic arriving on approach a comes from
+// neighbor[a][i] and is served by the NS phase for a = 0, 2 and EW for 1, 3.
+// The plan is a common cycle plus a green split and offset per intersection;
+// the NS phase starts at offset, EW LOST_TIME_S / 2 after NS ends.
+struct signal_network {
+    int count;
+    int32_t *neighbor[NUM_APPROACHES];  // -1 at the edge
+    float *travel_s[NUM_APPROACHES];    // From that neighbour
+    uint8_t *color;                     // No two neighbours share a colour
+    int num_colors;
+    float *demand[NUM_APPROACHES];      // Latest flow, veh/h
+    float *planned[NUM_APPROACHES];     // Flow the current plan was built for
+    float *green_ns, *green_ew, *offset;
+    int cycle_s;
+    uint8_t *dirty;
+    int32_t *dirty_list;
+    int num_dirty;
+    uint32_t *region_epoch;             // == epoch while in the region being re-optimized
+    uint32_t epoch;
+    int32_t *region, *by_color[MAX_COLORS];
+    int region_count, color_count[MAX_COLORS];
+    // Worker pool; the caller of network_optimize is worker 0
+    plan_worker_t workers[MAX_OPTIMIZER_THREADS];
+    pthread_t threads[MAX_OPTIMIZER_THREADS];
+    int num_workers;
+    pthread_barrier_t start, done;
+    pthread_mutex_t setup;              // Held while the pool is started
+    plan_job_t job;
+    int job_color;
+    bool stop;
+    uint64_t updates, touched, update_ns_total, update_ns_max;
+};
+
+typedef struct traffic_sim traffic_sim_t;
+
+typedef struct {
+    traffic_sim_t *sim;
+    int index, begin, end;    // Intersections this worker owns
+} sim_worker_t;
+
+// Link queue model on the network's grid. Each approach holds a stop-line
+// queue served at saturation flow while its phase is green, fed by a ring of
+// vehicles still travelling from the upstream intersection. A step runs in two
+// phases split by a barrier: every intersection discharges its queues into
+// per-side outboxes, then every approach pulls what its upstream neighbour
+// sent. Each array entry has a single writer and all randomness is a hash of
+// (seed, intersection, step), so results do not depend on the thread count.
+struct traffic_sim {
+    const signal_network_t *net;
+    int count;
+    uint64_t seed;
+    uint32_t step;                      // Simulated seconds since midnight of day 0
+    int16_t *cycle_s, *offset_s, *green_ns, *green_ew;  // Signal plan being run
+    float *entry_vph[NUM_APPROACHES];   // Peak arrivals from outside the network, 0 inside
+    uint8_t *travel[NUM_APPROACHES];    // Whole seconds from the upstream neighbour
+    uint32_t *queue[NUM_APPROACHES];
+    float *credit[NUM_APPROACHES];      // Saturation flow carried over between seconds
+    float *flow_vph[NUM_APPROACHES];    // Smoothed stop-line arrivals, what GPS would report
+    uint16_t *ring[NUM_APPROACHES];     // [intersection * SIM_RING + second % SIM_RING]
+    uint16_t *out[NUM_APPROACHES];      // Left through each side this step
+    uint64_t *entered, *exited, *waiting_s;  // Per intersection, written by its owner
+    sim_worker_t workers[SIM_MAX_THREADS];
+    pthread_t threads[SIM_MAX_THREADS];
+    int num_workers;
+    pthread_barrier_t start, phase, done;
+    pthread_mutex_t setup;              // Held while the pool is started
+    uint32_t run_steps;
+    bool stop;
+    // Stop-line detector pulses of intersection 0, from the thread that owns it
+    void (*on_pulse)(uint32_t lane, uint64_t t_us, uint32_t on_us);
+};
+
+// Sensor and actuator backend: the hardware drivers, or the simulation
+typedef struct {
+    uint32_t (*density)(int approach);
+    float (*flow)(int intersection, int approach);
+    void (*set_light)(int approach, int green_s);
+    void (*send_plan)(int intersection, int cycle_s, int offset_s, int green_ns, int green_ew);
+    uint64_t (*clock_us)(void);   // Timebase of the detector pulses
+    bool (*emergency)(void);
+    bool (*pedestrian)(void);
+    bool (*accident)(void);
+    void (*accident_alert)(void);
+    void (*send_log)(const char *log);
+    void (*emergency_priority)(void);
+    bool (*manual_override)(int *timings);  // Fills the app's timings when it has taken over
+} traffic_io_t;
+
+typedef struct {
+    detector_ingest_t *ingest;
+    int index, producers;
+    uint64_t pulses;
+} ingest_producer_t;
+
+bool init_system();
 void read_sensors();
 void process_traffic_data();
 void update_traffic_lights();
@@ -22,32 +177,128 @@ void track_traffic_flow();
 void mobile_app_control();
 void detect_accidents();
 void ai_predictive_traffic_management();
+bool network_init(signal_network_t *net, int count, int workers);
+void network_free(signal_network_t *net);
+void network_connect(signal_network_t *net, int i, int side, int j, float travel_s);
+bool network_build_grid(signal_network_t *net, int rows, int cols, float travel_s, int workers);
+void network_set_demand(signal_network_t *net, int i, const float *flows);
+void network_optimize(signal_network_t *net);
+float network_cost(const signal_network_t *net);
+void *network_worker(void *arg);
+bool sim_init(traffic_sim_t *sim, const signal_network_t *net, uint64_t seed, int workers);
+void sim_free(traffic_sim_t *sim);
+void sim_run(traffic_sim_t *sim, uint32_t seconds);
+void *sim_worker(void *arg);
+void control_cycle();
+uint64_t monotonic_ns();
+void on_detector_pulse(uint32_t lane, uint64_t t_us, uint32_t on_us);
+void detector_aggregate(uint64_t now_us);
+void start_detector_ingest();
+void *detector_ingest_worker(void *arg);
+void *ingest_producer(void *arg);
+void run_ingest_benchmark();
+void run_network_benchmark();
+bool run_simulation(double hours, int rows, int cols);
+void run_sim_benchmark();
+uint32_t hardware_density(int approach);
+float hardware_flow(int intersection, int approach);
+void hardware_set_light(int approach, int green_s);
+void hardware_send_plan(int intersection, int cycle_s, int offset_s, int green_ns, int green_ew);
+uint64_t hardware_clock_us();
+bool hardware_emergency();
+bool hardware_pedestrian();
+bool hardware_accident();
+void hardware_accident_alert();
+void hardware_send_log(const char *log);
+void hardware_emergency_priority();
+bool hardware_manual_override(int *timings);
+uint32_t sim_density(int approach);
+float sim_flow(int intersection, int approach);
+void sim_set_light(int approach, int green_s);
+void sim_send_plan(int intersection, int cycle_s, int offset_s, int green_ns, int green_ew);
+uint64_t sim_clock_us();
+bool sim_none();
+void sim_ignore();
+void sim_send_log(const char *log);
+bool sim_manual_override(int *timings);
 
-uint8_t vehicle_count[4] = {0}; // Traffic density for 4 directions
+uint32_t vehicle_count[4] = {0}; // Traffic density (vehicles on the approach) for 4 directions
+uint32_t window_count[4] = {0};   // Vehicles over the stop line in the detector window, all lanes
+uint32_t occupancy_permille[4] = {0};
+uint32_t headway_ms[4] = {0};
 bool emergency_vehicle_detected = false;
 bool pedestrian_waiting = false;
 bool accident_detected = false;
 float gps_traffic_flow_data[4] = {0.0};
+signal_network_t network;
+int corridor_rows = CORRIDOR_ROWS, corridor_cols = CORRIDOR_COLS;
+traffic_sim_t sim;
+detector_ingest_t detectors;
+detector_window_t approach_window[NUM_APPROACHES];  // Published under detector_lock
+bool detector_pulses_seen = false;
+bool detector_density = true;  // Off in simulation, where the link queues are the density
+pthread_mutex_t detector_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_t detector_thread;
+bool detector_thread_running = false;
+uint32_t cycle_count = 0;
+uint32_t cycle_log_period = 1;  // Cycles between status lines; events always print
+bool cycle_logged = true;
+
+const traffic_io_t hardware_io = {hardware_density, hardware_flow, hardware_set_light, hardware_send_plan, hardware_clock_us,
+                                  hardware_emergency, hardware_pedestrian, hardware_accident, hardware_accident_alert,
+                                  hardware_send_log, hardware_emergency_priority, hardware_manual_override};
+// The simulated city has no emergencies, pedestrians, accidents or app users
+const traffic_io_t sim_io = {sim_density, sim_flow, sim_set_light, sim_send_plan, sim_clock_us,
+                             sim_none, sim_none, sim_none, sim_ignore, sim_send_log, sim_ignore, sim_manual_override};
+const traffic_io_t *io = &hardware_io;
 
-int main() {
-    init_system();
+// Usage: traffic                               run the controller
+//        traffic network-bench                 corridor optimizer at 100 and 1024 intersections
+//        traffic simulate [hours] [rows cols]  control loop against the simulated city
+//        traffic sim-bench                     simulation speed and determinism
+//        traffic ingest-bench                  detector pulse ingestion rate
+int main(int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "network-bench") == 0) {
+        run_network_benchmark();
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "simulate") == 0) {
+        return run_simulation(argc >= 3 ? atof(argv[2]) : 1.0, argc >= 5 ? atoi(argv[3]) : 4, argc >= 5 ? atoi(argv[4]) : 4) ? 0 : 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "sim-bench") == 0) {
+        run_sim_benchmark();
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "ingest-bench") == 0) {
+        run_ingest_benchmark();
+        return 0;
+    }
+    if (!init_system()) {
+        return 1;
+    }
+    start_detector_ingest();
     
     while (1) {
-        read_sensors();
-        track_traffic_flow();
-        detect_accidents();
-        ai_predictive_traffic_management();
-        process_traffic_data();
-        update_traffic_lights();
-        send_data();
-        handle_emergency_vehicle();
-        mobile_app_control();
+        control_cycle();
         sleep(1);
     }
     return 0;
 }
 
-void init_system() {
+void control_cycle() {
+    cycle_logged = cycle_count++ % cycle_log_period == 0;
+    read_sensors();
+    track_traffic_flow();
+    detect_accidents();
+    ai_predictive_traffic_management();
+    process_traffic_data();
+    update_traffic_lights();
+    send_data();
+    handle_emergency_vehicle();
+    mobile_app_control();
+}
+
+bool init_system() {
     printf("Initializing Smart Traffic Light System with AI, GPS, Mobile App, and Accident Detection...\n");
     traffic_sensor_init();
     ai_module_init();
@@ -57,77 +308,1244 @@ void init_system() {
     gps_module_init();
     mobile_app_init();
     accident_detector_init();
+
+    if (!network_build_grid(&network, corridor_rows, corridor_cols, BLOCK_TRAVEL_S, (int)sysconf(_SC_NPROCESSORS_ONLN))) {
+        return false;
+    }
+    if (!detector_ingest_init(&detectors, NUM_APPROACHES * DETECTOR_LANES_PER_APPROACH)) {
+        network_free(&network);
+        return false;
+    }
+    return true;
 }
 
+// Detectors that only report a density level are polled. Once pulses arrive
+// density comes from the detector windows instead, in the same unit the AI
+// module expects: mean lane occupancy over the window times the vehicles that
+// fit in DENSITY_ZONE_M of every lane. The raw window count, occupancy and
+// headway are kept alongside for logging. The simulation's pulses only feed
+// those; its density stays the queue on each approach.
 void read_sensors() {
+    if (!detector_thread_running) {
+        detector_aggregate(io->clock_us());
+    }
+    pthread_mutex_lock(&detector_lock);
     for (int i = 0; i < 4; i++) {
-        vehicle_count[i] = read_traffic_density(i);
+        if (detector_pulses_seen) {
+            window_count[i] = approach_window[i].count;
+            occupancy_permille[i] = approach_window[i].occupancy_permille;
+            headway_ms[i] = approach_window[i].headway_ms;
+        }
+        if (detector_pulses_seen && detector_density) {
+            vehicle_count[i] = (uint32_t)lroundf(approach_window[i].occupancy_permille / 1000.0f * DETECTOR_LANES_PER_APPROACH *
+                                                 DENSITY_ZONE_M / VEHICLE_EFFECTIVE_M);
+        } else {
+            vehicle_count[i] = io->density(i);
+        }
+    }
+    pthread_mutex_unlock(&detector_lock);
+    emergency_vehicle_detected = io->emergency();
+    pedestrian_waiting = io->pedestrian();
+    if (!cycle_logged) {
+        return;
     }
-    emergency_vehicle_detected = detect_emergency_vehicle();
-    pedestrian_waiting = detect_pedestrian_waiting();
-    printf("Traffic Density: [%d, %d, %d, %d], Emergency: %d, Pedestrian: %d\n", 
+    printf("Traffic Density: [%u, %u, %u, %u], Count: [%u, %u, %u, %u], Occupancy: [%u, %u, %u, %u] permille, Headway: [%u, %u, %u, %u] ms, Emergency: %d, Pedestrian: %d\n", 
            vehicle_count[0], vehicle_count[1], vehicle_count[2], vehicle_count[3], 
+           window_count[0], window_count[1], window_count[2], window_count[3],
+           occupancy_permille[0], occupancy_permille[1], occupancy_permille[2], occupancy_permille[3],
+           headway_ms[0], headway_ms[1], headway_ms[2], headway_ms[3],
            emergency_vehicle_detected, pedestrian_waiting);
 }
 
+// GPS flow is vehicles per hour on each approach; the rest of the corridor
+// comes from the same feed by intersection
 void track_traffic_flow() {
     for (int i = 0; i < 4; i++) {
-        gps_traffic_flow_data[i] = get_gps_traffic_data(i);
+        gps_traffic_flow_data[i] = io->flow(0, i);
+    }
+    network_set_demand(&network, 0, gps_traffic_flow_data);
+    for (int n = 1; n < network.count; n++) {
+        float flows[NUM_APPROACHES];
+        for (int a = 0; a < NUM_APPROACHES; a++) {
+            flows[a] = io->flow(n, a);
+        }
+        network_set_demand(&network, n, flows);
+    }
+    if (!cycle_logged) {
+        return;
     }
     printf("GPS Traffic Flow Data: [%.2f, %.2f, %.2f, %.2f]\n", 
            gps_traffic_flow_data[0], gps_traffic_flow_data[1], gps_traffic_flow_data[2], gps_traffic_flow_data[3]);
 }
 
 void detect_accidents() {
-    accident_detected = check_accident_status();
+    accident_detected = io->accident();
     if (accident_detected) {
-        send_accident_alert();
+        io->accident_alert();
         printf("Accident detected! Alert sent to authorities.\n");
     }
 }
 
 void ai_predictive_traffic_management() {
     adjust_traffic_flow_based_on_prediction(vehicle_count, gps_traffic_flow_data);
-    printf("AI-based predictive traffic management executed.\n");
+    if (cycle_logged) {
+        printf("AI-based predictive traffic management executed.\n");
+    }
 }
 
 void process_traffic_data() {
     optimize_traffic_flow(vehicle_count, emergency_vehicle_detected, pedestrian_waiting);
 }
 
+// A standalone intersection keeps the AI module's timings; in a corridor the
+// coordinated plan sets the greens and every intersection gets its offset
 void update_traffic_lights() {
     int signal_timings[4];
     calculate_signal_timings(vehicle_count, emergency_vehicle_detected, pedestrian_waiting, gps_traffic_flow_data, signal_timings);
+    if (network.count > 1) {
+        network_optimize(&network);
+        for (int n = 0; n < network.count; n++) {
+            io->send_plan(n, network.cycle_s, (int)network.offset[n], (int)network.green_ns[n], (int)network.green_ew[n]);
+        }
+        if (!emergency_vehicle_detected) {
+            for (int i = 0; i < 4; i++) {
+                signal_timings[i] = (int)(i & 1 ? network.green_ew[0] : network.green_ns[0]);
+            }
+        }
+        if (cycle_logged) {
+            printf("Corridor plan: %d intersections, cycle %d s, offset %.0f s\n", network.count, network.cycle_s, network.offset[0]);
+        }
+    }
     for (int i = 0; i < 4; i++) {
-        set_traffic_light(i, signal_timings[i]);
+        io->set_light(i, signal_timings[i]);
+    }
+    if (!cycle_logged) {
+        return;
     }
     printf("Updated traffic light timings: [%d, %d, %d, %d]\n", signal_timings[0], signal_timings[1], signal_timings[2], signal_timings[3]);
 }
 
 void send_data() {
-    char traffic_log[150];
-    sprintf(traffic_log, "Traffic: [%d, %d, %d, %d], GPS: [%.2f, %.2f, %.2f, %.2f], Emergency: %d, Pedestrian: %d, Accident: %d", 
+    char traffic_log[200];
+    sprintf(traffic_log, "Traffic: [%u, %u, %u, %u], GPS: [%.2f, %.2f, %.2f, %.2f], Emergency: %d, Pedestrian: %d, Accident: %d", 
             vehicle_count[0], vehicle_count[1], vehicle_count[2], vehicle_count[3], 
             gps_traffic_flow_data[0], gps_traffic_flow_data[1], gps_traffic_flow_data[2], gps_traffic_flow_data[3], 
             emergency_vehicle_detected, pedestrian_waiting, accident_detected);
-    send_traffic_data_to_server(traffic_log);
-    printf("Traffic data sent: %s\n", traffic_log);
+    io->send_log(traffic_log);
+    if (cycle_logged) {
+        printf("Traffic data sent: %s\n", traffic_log);
+    }
 }
 
 void handle_emergency_vehicle() {
     if (emergency_vehicle_detected) {
-        give_priority_to_emergency_vehicle();
+        io->emergency_priority();
         printf("Emergency vehicle detected! Priority given.\n");
     }
 }
 
 void mobile_app_control() {
-    if (check_manual_override()) {
-        int user_signal_timings[4];
-        get_manual_signal_timings(user_signal_timings);
+    int user_signal_timings[4];
+    if (io->manual_override(user_signal_timings)) {
         for (int i = 0; i < 4; i++) {
-            set_traffic_light(i, user_signal_timings[i]);
+            io->set_light(i, user_signal_timings[i]);
         }
         printf("Manual control applied: [%d, %d, %d, %d]\n", user_signal_timings[0], user_signal_timings[1], user_signal_timings[2], user_signal_timings[3]);
     }
 }
+
+uint32_t hardware_density(int approach) {
+    return read_traffic_density(approach);
+}
+
+float hardware_flow(int intersection, int approach) {
+    return intersection == 0 ? get_gps_traffic_data(approach) : get_corridor_traffic_data(intersection, approach);
+}
+
+void hardware_set_light(int approach, int green_s) {
+    set_traffic_light(approach, green_s);
+}
+
+void hardware_send_plan(int intersection, int cycle_s, int offset_s, int green_ns, int green_ew) {
+    send_signal_plan(intersection, cycle_s, offset_s, green_ns, green_ew);
+}
+
+// Detector drivers stamp pulses with CLOCK_MONOTONIC
+uint64_t hardware_clock_us() {
+    return monotonic_ns() / 1000;
+}
+
+bool hardware_emergency() {
+    return detect_emergency_vehicle();
+}
+
+bool hardware_pedestrian() {
+    return detect_pedestrian_waiting();
+}
+
+bool hardware_accident() {
+    return check_accident_status();
+}
+
+void hardware_accident_alert() {
+    send_accident_alert();
+}
+
+void hardware_send_log(const char *log) {
+    send_traffic_data_to_server(log);
+}
+
+void hardware_emergency_priority() {
+    give_priority_to_emergency_vehicle();
+}
+
+bool hardware_manual_override(int *timings) {
+    if (!check_manual_override()) {
+        return false;
+    }
+    get_manual_signal_timings(timings);
+    return true;
+}
+
+uint64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+// Called from the detector drivers' threads, one call per vehicle
+void on_detector_pulse(uint32_t lane, uint64_t t_us, uint32_t on_us) {
+    detector_push(&detectors, lane, t_us, on_us);
+}
+
+// Folds queued pulses into the lane windows and publishes per-approach
+// totals: counts add up, occupancy and headway are lane averages
+void detector_aggregate(uint64_t now_us) {
+    detector_window_t windows[NUM_APPROACHES];
+
+    while (detector_drain(&detectors, DETECTOR_QUEUE_SIZE) == DETECTOR_QUEUE_SIZE) {
+    }
+    for (int a = 0; a < NUM_APPROACHES; a++) {
+        uint32_t occupancy = 0, headway = 0, headway_lanes = 0;
+        windows[a].count = 0;
+        for (int k = 0; k < DETECTOR_LANES_PER_APPROACH; k++) {
+            detector_window_t lane = detector_window(&detectors, (uint32_t)(a * DETECTOR_LANES_PER_APPROACH + k), now_us);
+            windows[a].count += lane.count;
+            occupancy += lane.occupancy_permille;
+            if (lane.headway_ms) {
+                headway += lane.headway_ms;
+                headway_lanes++;
+            }
+        }
+        windows[a].occupancy_permille = occupancy / DETECTOR_LANES_PER_APPROACH;
+        windows[a].headway_ms = headway_lanes ? headway / headway_lanes : 0;
+    }
+    pthread_mutex_lock(&detector_lock);
+    memcpy(approach_window, windows, sizeof(windows));
+    detector_pulses_seen = detectors.consumed > 0;
+    pthread_mutex_unlock(&detector_lock);
+}
+
+void start_detector_ingest() {
+    traffic_sensor_set_pulse_handler(on_detector_pulse);
+    if (pthread_create(&detector_thread, NULL, detector_ingest_worker, NULL) != 0) {
+        printf("[ERROR] Failed to start detector ingest thread, aggregating in the control loop.\n");
+        return;
+    }
+    detector_thread_running = true;
+}
+
+// Sole consumer of the pulse queue
+void *detector_ingest_worker(void *arg) {
+    uint64_t published_us = 0;
+    (void)arg;
+
+    for (;;) {
+        uint32_t drained = detector_drain(&detectors, DETECTOR_QUEUE_SIZE);
+        uint64_t now_us = io->clock_us();
+        if (now_us - published_us >= DETECTOR_PUBLISH_US) {
+            detector_aggregate(now_us);
+            published_us = now_us;
+        }
+        if (drained == 0) {
+            usleep(DETECTOR_IDLE_US);
+        }
+    }
+    return NULL;
+}
+
+bool network_init(signal_network_t *net, int count, int workers) {
+    if (count < 1 || count > MAX_INTERSECTIONS) {
+        printf("[ERROR] Intersection count %d out of range.\n", count);
+        return false;
+    }
+    memset(net, 0, sizeof(*net));
+    net->count = count;
+    bool ok = true;
+    for (int a = 0; a < NUM_APPROACHES; a++) {
+        ok &= (net->neighbor[a] = malloc(count * sizeof(int32_t))) != NULL;
+        ok &= (net->travel_s[a] = calloc(count, sizeof(float))) != NULL;
+        ok &= (net->demand[a] = calloc(count, sizeof(float))) != NULL;
+        ok &= (net->planned[a] = calloc(count, sizeof(float))) != NULL;
+        if (net->neighbor[a]) {
+            memset(net->neighbor[a], 0xff, count * sizeof(int32_t));
+        }
+    }
+    for (int c = 0; c < MAX_COLORS; c++) {
+        ok &= (net->by_color[c] = malloc(count * sizeof(int32_t))) != NULL;
+    }
+    ok &= (net->color = calloc(count, 1)) != NULL;
+    ok &= (net->green_ns = calloc(count, sizeof(float))) != NULL;
+    ok &= (net->green_ew = calloc(count, sizeof(float))) != NULL;
+    ok &= (net->offset = calloc(count, sizeof(float))) != NULL;
+    ok &= (net->dirty = calloc(count, 1)) != NULL;
+    ok &= (net->dirty_list = malloc(count * sizeof(int32_t))) != NULL;
+    ok &= (net->region_epoch = calloc(count, sizeof(uint32_t))) != NULL;
+    ok &= (net->region = malloc(count * sizeof(int32_t))) != NULL;
+    if (!ok) {
+        printf("[ERROR] Out of memory for %d intersections.\n", count);
+        network_free(net);
+        return false;
+    }
+    // Everything is planned on the first update
+    for (int i = 0; i < count; i++) {
+        net->dirty[i] = 1;
+        net->dirty_list[i] = i;
+    }
+    net->num_dirty = count;
+
+    // No more workers than intersections; workers wait on setup until the
+    // barriers are sized for however many threads could be started
+    workers = workers < count ? workers : count;
+    net->num_workers = workers < 1 ? 1 : workers > MAX_OPTIMIZER_THREADS ? MAX_OPTIMIZER_THREADS : workers;
+    pthread_mutex_init(&net->setup, NULL);
+    pthread_mutex_lock(&net->setup);
+    for (int w = 0; w < net->num_workers; w++) {
+        net->workers[w].net = net;
+        net->workers[w].index = w;
+        if (w > 0 && pthread_create(&net->threads[w], NULL, network_worker, &net->workers[w]) != 0) {
+            printf("[WARN] Corridor optimizer running on %d of %d threads.\n", w, net->num_workers);
+            net->num_workers = w;
+        }
+    }
+    if (net->num_workers > 1) {
+        pthread_barrier_init(&net->start, NULL, (unsigned)net->num_workers);
+        pthread_barrier_init(&net->done, NULL, (unsigned)net->num_workers);
+    }
+    pthread_mutex_unlock(&net->setup);
+    return true;
+}
+
+void network_free(signal_network_t *net) {
+    if (net->num_workers > 1) {
+        net->stop = true;
+        pthread_barrier_wait(&net->start);
+        for (int w = 1; w < net->num_workers; w++) {
+            pthread_join(net->threads[w], NULL);
+        }
+        pthread_barrier_destroy(&net->start);
+        pthread_barrier_destroy(&net->done);
+    }
+    if (net->num_workers > 0) {
+        pthread_mutex_destroy(&net->setup);
+    }
+    for (int a = 0; a < NUM_APPROACHES; a++) {
+        free(net->neighbor[a]);
+        free(net->travel_s[a]);
+        free(net->demand[a]);
+        free(net->planned[a]);
+    }
+    for (int c = 0; c < MAX_COLORS; c++) {
+        free(net->by_color[c]);
+    }
+    free(net->color);
+    free(net->green_ns);
+    free(net->green_ew);
+    free(net->offset);
+    free(net->dirty);
+    free(net->dirty_list);
+    free(net->region_epoch);
+    free(net->region);
+    memset(net, 0, sizeof(*net));
+}
+
+// j lies on the given side of i; the link carries traffic both ways
+void network_connect(signal_network_t *net, int i, int side, int j, float travel_s) {
+    int back = (side + 2) % NUM_APPROACHES;
+    net->neighbor[side][i] = j;
+    net->travel_s[side][i] = travel_s;
+    net->neighbor[back][j] = i;
+    net->travel_s[back][j] = travel_s;
+}
+
+// Greedy colouring; a grid needs two colours, other layouts a few more
+void network_color(signal_network_t *net) {
+    net->num_colors = 1;
+    for (int i = 0; i < net->count; i++) {
+        uint32_t used = 0;
+        for (int a = 0; a < NUM_APPROACHES; a++) {
+            int j = net->neighbor[a][i];
+            if (j >= 0 && j < i) {
+                used |= 1u << net->color[j];
+            }
+        }
+        int c = 0;
+        while (used & (1u << c)) {
+            c++;
+        }
+        net->color[i] = (uint8_t)c;
+        net->num_colors = c + 1 > net->num_colors ? c + 1 : net->num_colors;
+    }
+}
+
+bool network_build_grid(signal_network_t *net, int rows, int cols, float travel_s, int workers) {
+    if (rows < 1 || cols < 1 || rows > MAX_INTERSECTIONS / cols) {
+        printf("[ERROR] Grid of %d x %d intersections out of range.\n", rows, cols);
+        return false;
+    }
+    if (!network_init(net, rows * cols, workers)) {
+        return false;
+    }
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            int i = r * cols + c;
+            if (c + 1 < cols) {
+                network_connect(net, i, 1, i + 1, travel_s);  // East
+            }
+            if (r + 1 < rows) {
+                network_connect(net, i, 2, i + cols, travel_s);  // South
+            }
+        }
+    }
+    network_color(net);
+    return true;
+}
+
+void network_set_demand(signal_network_t *net, int i, const float *flows) {
+    bool changed = false;
+    for (int a = 0; a < NUM_APPROACHES; a++) {
+        float base = net->planned[a][i] > DEMAND_FLOOR_VPH ? net->planned[a][i] : DEMAND_FLOOR_VPH;
+        changed |= fabsf(flows[a] - net->planned[a][i]) > DEMAND_CHANGE * base;
+        net->demand[a][i] = flows[a];
+    }
+    if (changed && !net->dirty[i]) {
+        net->dirty[i] = 1;
+        net->dirty_list[net->num_dirty++] = i;
+    }
+}
+
+// Webster's cycle for the most loaded intersection, rounded to 10 s so small
+// demand changes do not reset every offset in the network
+int network_cycle(const signal_network_t *net) {
+    float worst = 0.0f;
+    for (int i = 0; i < net->count; i++) {
+        float ns = fmaxf(net->demand[0][i], net->demand[2][i]);
+        float ew = fmaxf(net->demand[1][i], net->demand[3][i]);
+        worst = fmaxf(worst, (ns + ew) / SAT_FLOW_VPH);
+    }
+    worst = fminf(worst, 0.9f);
+    int cycle = (int)ceilf((1.5f * LOST_TIME_S + 5.0f) / (1.0f - worst) / 10.0f) * 10;
+    return cycle < CYCLE_MIN_S ? CYCLE_MIN_S : cycle > CYCLE_MAX_S ? CYCLE_MAX_S : cycle;
+}
+
+// Greens proportional to each phase's critical flow ratio, with neither red
+// longer than MAX_WAIT_TIME
+void network_plan_splits(signal_network_t *net, int i) {
+    float cycle = (float)net->cycle_s;
+    float effective = cycle - LOST_TIME_S;
+    float y_ns = fmaxf(net->demand[0][i], net->demand[2][i]);
+    float y_ew = fmaxf(net->demand[1][i], net->demand[3][i]);
+    float green = y_ns + y_ew > 0.0f ? effective * y_ns / (y_ns + y_ew) : effective / 2;
+    float min_green = fmaxf((float)MIN_GREEN_S, cycle - MAX_WAIT_TIME);
+
+    green = fminf(fmaxf(green, min_green), effective - min_green);
+    net->green_ns[i] = roundf(green);
+    net->green_ew[i] = effective - net->green_ns[i];
+}
+
+// Share of the platoon released by 'from' that reaches 'to' on red, weighted
+// by its flow. The platoon fills from's green for that axis and arrives
+// travel_s later.
+float link_cost(const signal_network_t *net, int from, float from_offset, int to, float to_offset, int approach) {
+    float flow = net->demand[approach][to];
+    if (flow <= 0.0f) {
+        return 0.0f;
+    }
+    float cycle = (float)net->cycle_s;
+    bool ew = approach & 1;
+    float width = ew ? net->green_ew[from] : net->green_ns[from];
+    float green = ew ? net->green_ew[to] : net->green_ns[to];
+    float from_start = from_offset + (ew ? net->green_ns[from] + LOST_TIME_S / 2 : 0.0f);
+    float to_start = to_offset + (ew ? net->green_ns[to] + LOST_TIME_S / 2 : 0.0f);
+    float d = fmodf(from_start + net->travel_s[approach][to] - to_start, cycle);
+    if (d < 0.0f) {
+        d += cycle;
+    }
+    // Platoon [d, d + width) against greens [0, green) and [cycle, cycle + green)
+    float overlap = fmaxf(0.0f, fminf(green - d, width)) + fmaxf(0.0f, fminf(d + width, cycle + green) - cycle);
+    return flow * (1.0f - overlap / width);
+}
+
+// Cost of every link into or out of i with i at the given offset
+float network_local_cost(const signal_network_t *net, int i, float offset) {
+    float cost = 0.0f;
+    for (int a = 0; a < NUM_APPROACHES; a++) {
+        int j = net->neighbor[a][i];
+        if (j >= 0) {
+            cost += link_cost(net, j, net->offset[j], i, offset, a);
+            cost += link_cost(net, i, offset, j, net->offset[j], (a + 2) % NUM_APPROACHES);
+        }
+    }
+    return cost;
+}
+
+void network_plan_offset(signal_network_t *net, int i) {
+    float best = net->offset[i];
+    float best_cost = network_local_cost(net, i, best) - 1e-3f;  // Only move for a real gain
+    for (int o = 0; o < net->cycle_s; o += OFFSET_STEP_S) {
+        float cost = network_local_cost(net, i, (float)o);
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = (float)o;
+        }
+    }
+    net->offset[i] = best;
+}
+
+// Worker w takes one contiguous slice of the current list
+void network_run_batch(signal_network_t *net, int w) {
+    const int32_t *list = net->job == PLAN_SPLITS ? net->region : net->by_color[net->job_color];
+    int count = net->job == PLAN_SPLITS ? net->region_count : net->color_count[net->job_color];
+    int chunk = (count + net->num_workers - 1) / net->num_workers;
+    int end = (w + 1) * chunk < count ? (w + 1) * chunk : count;
+
+    for (int k = w * chunk; k < end; k++) {
+        if (net->job == PLAN_SPLITS) {
+            network_plan_splits(net, list[k]);
+        } else {
+            network_plan_offset(net, list[k]);
+        }
+    }
+}
+
+void *network_worker(void *arg) {
+    plan_worker_t *worker = arg;
+    signal_network_t *net = worker->net;
+
+    pthread_mutex_lock(&net->setup);
+    pthread_mutex_unlock(&net->setup);
+    for (;;) {
+        pthread_barrier_wait(&net->start);
+        if (net->stop) {
+            break;
+        }
+        network_run_batch(net, worker->index);
+        pthread_barrier_wait(&net->done);
+    }
+    return NULL;
+}
+
+void network_parallel(signal_network_t *net, plan_job_t job, int color) {
+    net->job = job;
+    net->job_color = color;
+    if (net->num_workers > 1) {
+        pthread_barrier_wait(&net->start);
+    }
+    network_run_batch(net, 0);
+    if (net->num_workers > 1) {
+        pthread_barrier_wait(&net->done);
+    }
+}
+
+// Re-plans the intersections whose demand changed and everything within
+// NEIGHBORHOOD_HOPS of them; the rest of the network holds its plan and acts
+// as the boundary. Offsets are improved by coordinate descent one colour at a
+// time, so intersections optimized together never see each other move.
+void network_optimize(signal_network_t *net) {
+    uint64_t start_ns = monotonic_ns();
+    int cycle = network_cycle(net);
+
+    // Lengthen as soon as demand needs it, shorten only once it clearly does
+    // not; the old offsets are stretched to the new cycle as a starting point
+    if (cycle > net->cycle_s || cycle < net->cycle_s - 10) {
+        for (int i = 0; i < net->count && net->cycle_s; i++) {
+            net->offset[i] = roundf(net->offset[i] * cycle / net->cycle_s / OFFSET_STEP_S) * OFFSET_STEP_S;
+        }
+        net->cycle_s = cycle;
+        for (int i = 0; i < net->count; i++) {
+            if (!net->dirty[i]) {
+                net->dirty[i] = 1;
+                net->dirty_list[net->num_dirty++] = i;
+            }
+        }
+    }
+    if (net->num_dirty == 0) {
+        return;
+    }
+
+    // Breadth-first out from the changed intersections
+    net->epoch++;
+    net->region_count = 0;
+    for (int k = 0; k < net->num_dirty; k++) {
+        int i = net->dirty_list[k];
+        net->region_epoch[i] = net->epoch;
+        net->region[net->region_count++] = i;
+    }
+    for (int hop = 0, begin = 0; hop < NEIGHBORHOOD_HOPS; hop++) {
+        int end = net->region_count;
+        for (int k = begin; k < end; k++) {
+            int i = net->region[k];
+            for (int a = 0; a < NUM_APPROACHES; a++) {
+                int j = net->neighbor[a][i];
+                if (j >= 0 && net->region_epoch[j] != net->epoch) {
+                    net->region_epoch[j] = net->epoch;
+                    net->region[net->region_count++] = j;
+                }
+            }
+        }
+        begin = end;
+    }
+    memset(net->color_count, 0, sizeof(net->color_count));
+    for (int k = 0; k < net->region_count; k++) {
+        int i = net->region[k];
+        net->by_color[net->color[i]][net->color_count[net->color[i]]++] = i;
+    }
+
+    network_parallel(net, PLAN_SPLITS, 0);
+    for (int sweep = 0; sweep < OFFSET_SWEEPS; sweep++) {
+        for (int c = 0; c < net->num_colors; c++) {
+            network_parallel(net, PLAN_OFFSETS, c);
+        }
+    }
+
+    for (int k = 0; k < net->num_dirty; k++) {
+        int i = net->dirty_list[k];
+        for (int a = 0; a < NUM_APPROACHES; a++) {
+            net->planned[a][i] = net->demand[a][i];
+        }
+        net->dirty[i] = 0;
+    }
+    net->num_dirty = 0;
+
+    uint64_t ns = monotonic_ns() - start_ns;
+    net->updates++;
+    net->touched += (uint64_t)net->region_count;
+    net->update_ns_total += ns;
+    net->update_ns_max = ns > net->update_ns_max ? ns : net->update_ns_max;
+}
+
+// Flow-weighted share of vehicles arriving on red, over the whole network
+float network_cost(const signal_network_t *net) {
+    float cost = 0.0f, flow = 0.0f;
+    for (int i = 0; i < net->count; i++) {
+        for (int a = 0; a < NUM_APPROACHES; a++) {
+            int j = net->neighbor[a][i];
+            if (j >= 0) {
+                cost += link_cost(net, j, net->offset[j], i, net->offset[i], a);
+                flow += net->demand[a][i];
+            }
+        }
+    }
+    return flow > 0.0f ? cost / flow : 0.0f;
+}
+
+float bench_flow(bool arterial) {
+    return arterial ? 400.0f + (float)(rand() % 500) : 100.0f + (float)(rand() % 200);
+}
+
+// Grids of 10x10 and 32x32 intersections with heavy east-west arterials on
+// every fourth row. Times the full plan, then 60 one-second cycles in which
+// 1% or 5% of the intersections see their demand change, and reports how much
+// of the network each incremental update touched.
+void run_network_benchmark() {
+    const int sides[] = {10, 32};
+    const int changed_percent[] = {1, 5};
+    int max_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    static float base[MAX_INTERSECTIONS][NUM_APPROACHES];
+
+    for (int s = 0; s < 2; s++) {
+        for (int workers = 1; workers <= max_workers; workers *= 2) {
+            int rows = sides[s], cols = sides[s];
+            signal_network_t net;
+
+            srand(1);
+            if (!network_build_grid(&net, rows, cols, BLOCK_TRAVEL_S, workers)) {
+                return;
+            }
+            for (int i = 0; i < net.count; i++) {
+                bool arterial = (i / cols) % 4 == 0;
+                base[i][0] = bench_flow(false);
+                base[i][1] = bench_flow(arterial);
+                base[i][2] = bench_flow(false);
+                base[i][3] = bench_flow(arterial);
+                network_set_demand(&net, i, base[i]);
+            }
+            net.cycle_s = network_cycle(&net);
+            for (int i = 0; i < net.count; i++) {
+                network_plan_splits(&net, i);
+            }
+            float uncoordinated = network_cost(&net);
+
+            network_optimize(&net);
+            printf("%4d intersections, %d workers: full plan %.2f ms, cycle %d s, arrivals on red %.1f%% -> %.1f%%\n",
+                   net.count, workers, net.update_ns_total / 1e6, net.cycle_s, uncoordinated * 100, network_cost(&net) * 100);
+
+            for (int p = 0; p < 2; p++) {
+                int changes = net.count * changed_percent[p] / 100;
+                net.updates = net.touched = net.update_ns_total = net.update_ns_max = 0;
+                for (int second = 0; second < 60; second++) {
+                    for (int k = 0; k < changes; k++) {
+                        int i = rand() % net.count;
+                        float flows[NUM_APPROACHES];
+                        for (int a = 0; a < NUM_APPROACHES; a++) {
+                            flows[a] = base[i][a] * (0.8f + (float)(rand() % 40) / 100.0f);
+                        }
+                        network_set_demand(&net, i, flows);
+                    }
+                    network_optimize(&net);
+                }
+                printf("    %d%% changing per second: %llu updates, avg %.1f intersections re-planned, avg %.2f ms max %.2f ms, "
+                       "arrivals on red %.1f%%\n",
+                       changed_percent[p], (unsigned long long)net.updates, net.updates ? (double)net.touched / net.updates : 0.0,
+                       net.updates ? net.update_ns_total / 1e6 / net.updates : 0.0, net.update_ns_max / 1e6, network_cost(&net) * 100);
+            }
+            network_free(&net);
+        }
+    }
+}
+
+uint64_t sim_hash(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Uniform in [0, 1) for the k-th draw of intersection i at the given second
+float sim_random(const traffic_sim_t *sim, int i, uint32_t step, uint32_t k) {
+    uint64_t h = sim_hash(sim->seed ^ sim_hash(((uint64_t)(uint32_t)i << 32) | step) ^ ((uint64_t)k << 48));
+    return (float)(h >> 40) / 16777216.0f;
+}
+
+// Share of the rush-hour entry rate at a time of day: morning and evening
+// peaks over a midday plateau and a quiet night
+float sim_demand_profile(uint32_t step) {
+    float h = (float)(step % 86400) / 3600.0f;
+    return 0.1f + 0.9f * expf(-(h - 8.0f) * (h - 8.0f) / 1.5f) + 0.8f * expf(-(h - 17.5f) * (h - 17.5f) / 2.0f) +
+           0.4f * expf(-(h - 13.0f) * (h - 13.0f) / 8.0f);
+}
+
+bool sim_init(traffic_sim_t *sim, const signal_network_t *net, uint64_t seed, int workers) {
+    int n = net->count;
+    bool ok = true;
+
+    memset(sim, 0, sizeof(*sim));
+    sim->net = net;
+    sim->count = n;
+    sim->seed = seed;
+    sim->step = SIM_START_S;
+    ok &= (sim->cycle_s = calloc(n, sizeof(int16_t))) != NULL;
+    ok &= (sim->offset_s = calloc(n, sizeof(int16_t))) != NULL;
+    ok &= (sim->green_ns = calloc(n, sizeof(int16_t))) != NULL;
+    ok &= (sim->green_ew = calloc(n, sizeof(int16_t))) != NULL;
+    ok &= (sim->entered = calloc(n, sizeof(uint64_t))) != NULL;
+    ok &= (sim->exited = calloc(n, sizeof(uint64_t))) != NULL;
+    ok &= (sim->waiting_s = calloc(n, sizeof(uint64_t))) != NULL;
+    for (int a = 0; a < NUM_APPROACHES; a++) {
+        ok &= (sim->entry_vph[a] = calloc(n, sizeof(float))) != NULL;
+        ok &= (sim->travel[a] = calloc(n, 1)) != NULL;
+        ok &= (sim->queue[a] = calloc(n, sizeof(uint32_t))) != NULL;
+        ok &= (sim->credit[a] = calloc(n, sizeof(float))) != NULL;
+        ok &= (sim->flow_vph[a] = calloc(n, sizeof(float))) != NULL;
+        ok &= (sim->ring[a] = calloc((size_t)n * SIM_RING, sizeof(uint16_t))) != NULL;
+        ok &= (sim->out[a] = calloc(n, sizeof(uint16_t))) != NULL;
+    }
+    if (!ok) {
+        printf("[ERROR] Out of memory simulating %d intersections.\n", n);
+        sim_free(sim);
+        return false;
+    }
+    // Until a plan arrives every intersection runs a fixed 60 s split
+    for (int i = 0; i < n; i++) {
+        sim->cycle_s[i] = 60;
+        sim->green_ns[i] = sim->green_ew[i] = (60 - LOST_TIME_S) / 2;
+        for (int a = 0; a < NUM_APPROACHES; a++) {
+            int travel = (int)lroundf(net->travel_s[a][i]);
+            sim->travel[a][i] = (uint8_t)(travel < 1 ? 1 : travel >= SIM_RING ? SIM_RING - 1 : travel);
+        }
+    }
+
+    // Contiguous bands of intersections, one per worker, assigned once the
+    // threads are up; workers wait on setup until then
+    workers = workers < n ? workers : n;
+    sim->num_workers = workers < 1 ? 1 : workers > SIM_MAX_THREADS ? SIM_MAX_THREADS : workers;
+    pthread_mutex_init(&sim->setup, NULL);
+    pthread_mutex_lock(&sim->setup);
+    for (int w = 0; w < sim->num_workers; w++) {
+        sim->workers[w].sim = sim;
+        sim->workers[w].index = w;
+        if (w > 0 && pthread_create(&sim->threads[w], NULL, sim_worker, &sim->workers[w]) != 0) {
+            printf("[WARN] Simulation running on %d of %d threads.\n", w, sim->num_workers);
+            sim->num_workers = w;
+        }
+    }
+    for (int w = 0; w < sim->num_workers; w++) {
+        sim->workers[w].begin = n * w / sim->num_workers;
+        sim->workers[w].end = n * (w + 1) / sim->num_workers;
+    }
+    if (sim->num_workers > 1) {
+        pthread_barrier_init(&sim->start, NULL, (unsigned)sim->num_workers);
+        pthread_barrier_init(&sim->phase, NULL, (unsigned)sim->num_workers);
+        pthread_barrier_init(&sim->done, NULL, (unsigned)sim->num_workers);
+    }
+    pthread_mutex_unlock(&sim->setup);
+    return true;
+}
+
+void sim_free(traffic_sim_t *sim) {
+    if (sim->num_workers > 1) {
+        sim->stop = true;
+        pthread_barrier_wait(&sim->start);
+        for (int w = 1; w < sim->num_workers; w++) {
+            pthread_join(sim->threads[w], NULL);
+        }
+        pthread_barrier_destroy(&sim->start);
+        pthread_barrier_destroy(&sim->phase);
+        pthread_barrier_destroy(&sim->done);
+    }
+    if (sim->num_workers > 0) {
+        pthread_mutex_destroy(&sim->setup);
+    }
+    free(sim->cycle_s);
+    free(sim->offset_s);
+    free(sim->green_ns);
+    free(sim->green_ew);
+    free(sim->entered);
+    free(sim->exited);
+    free(sim->waiting_s);
+    for (int a = 0; a < NUM_APPROACHES; a++) {
+        free(sim->entry_vph[a]);
+        free(sim->travel[a]);
+        free(sim->queue[a]);
+        free(sim->credit[a]);
+        free(sim->flow_vph[a]);
+        free(sim->ring[a]);
+        free(sim->out[a]);
+    }
+    memset(sim, 0, sizeof(*sim));
+}
+
+// Vehicles reaching the stop lines, plus arrivals from outside the network,
+// join the queues; green approaches discharge at saturation flow into the
+// outboxes, or out of the network at the edge
+void sim_discharge(traffic_sim_t *sim, int i, uint32_t step, float profile) {
+    const signal_network_t *net = sim->net;
+    int slot = (int)(step % SIM_RING);
+    int cycle = sim->cycle_s[i];
+    int t = ((int)(step % (uint32_t)cycle) - sim->offset_s[i] % cycle + cycle) % cycle;
+    int ew_start = sim->green_ns[i] + LOST_TIME_S / 2;
+    bool ns_green = t < sim->green_ns[i];
+    bool ew_green = t >= ew_start && t < ew_start + sim->green_ew[i];
+    const float flow_a = 1.0f - expf(-1.0f / SIM_FLOW_TAU_S);
+    uint32_t draw = 0, pulses = 0;
+
+    for (int a = 0; a < NUM_APPROACHES; a++) {
+        sim->out[a][i] = 0;
+    }
+    for (int a = 0; a < NUM_APPROACHES; a++) {
+        uint32_t arrivals = sim->ring[a][i * SIM_RING + slot];
+        sim->ring[a][i * SIM_RING + slot] = 0;
+        if (net->neighbor[a][i] < 0 && sim->entry_vph[a][i] > 0.0f) {
+            // Poisson by inversion; the rate stays well under one per second
+            float rate = sim->entry_vph[a][i] * profile / 3600.0f;
+            float u = sim_random(sim, i, step, draw++);
+            float p = expf(-rate), cdf = p;
+            uint32_t k = 0;
+            while (u > cdf && k < 8) {
+                k++;
+                p *= rate / (float)k;
+                cdf += p;
+            }
+            arrivals += k;
+            sim->entered[i] += k;
+        }
+        sim->queue[a][i] += arrivals;
+        if (sim->on_pulse && i == 0) {
+            // Separate draw range so the traffic itself is the same with or without detectors
+            for (uint32_t v = 0; v < arrivals; v++) {
+                uint32_t lane = (uint32_t)(a * DETECTOR_LANES_PER_APPROACH) + (uint32_t)(sim_random(sim, i, step, 0x8000 + 2 * pulses) * DETECTOR_LANES_PER_APPROACH);
+                uint64_t t_us = step * 1000000ULL + (uint64_t)(sim_random(sim, i, step, 0x8001 + 2 * pulses) * 1000000.0f);
+                sim->on_pulse(lane, t_us, SIM_PULSE_ON_US);
+                pulses++;
+            }
+        }
+        sim->flow_vph[a][i] += flow_a * ((float)arrivals * 3600.0f - sim->flow_vph[a][i]);
+
+        if (!(a & 1 ? ew_green : ns_green)) {
+            sim->credit[a][i] = 0.0f;
+        } else {
+            float credit = sim->credit[a][i] + SAT_FLOW_VPH / 3600.0f;
+            uint32_t served = (uint32_t)credit < sim->queue[a][i] ? (uint32_t)credit : sim->queue[a][i];
+            sim->queue[a][i] -= served;
+            credit -= (float)served;
+            sim->credit[a][i] = credit < 1.0f ? credit : 1.0f;
+            for (uint32_t v = 0; v < served; v++) {
+                int percent = (int)(sim_random(sim, i, step, draw++) * 100.0f);
+                int side = percent < SIM_STRAIGHT_PERCENT ? (a + 2) % NUM_APPROACHES
+                           : percent < SIM_STRAIGHT_PERCENT + (100 - SIM_STRAIGHT_PERCENT) / 2 ? (a + 1) % NUM_APPROACHES  // Left
+                                                                                                 : (a + 3) % NUM_APPROACHES;  // Right
+                if (net->neighbor[side][i] < 0) {
+                    sim->exited[i]++;
+                } else {
+                    sim->out[side][i]++;
+                }
+            }
+        }
+        sim->waiting_s[i] += sim->queue[a][i];
+    }
+}
+
+// Vehicles that left neighbour j through the side facing i are due at i's
+// stop line one travel time from now
+void sim_receive(traffic_sim_t *sim, int i, uint32_t step) {
+    const signal_network_t *net = sim->net;
+    for (int a = 0; a < NUM_APPROACHES; a++) {
+        int j = net->neighbor[a][i];
+        if (j >= 0) {
+            uint16_t *due = &sim->ring[a][i * SIM_RING + (int)((step + sim->travel[a][i]) % SIM_RING)];
+            *due = (uint16_t)(*due + sim->out[(a + 2) % NUM_APPROACHES][j]);
+        }
+    }
+}
+
+void sim_run_band(traffic_sim_t *sim, const sim_worker_t *worker) {
+    for (uint32_t k = 0; k < sim->run_steps; k++) {
+        uint32_t step = sim->step + k;
+        float profile = sim_demand_profile(step);
+        for (int i = worker->begin; i < worker->end; i++) {
+            sim_discharge(sim, i, step, profile);
+        }
+        if (sim->num_workers > 1) {
+            pthread_barrier_wait(&sim->phase);
+        }
+        for (int i = worker->begin; i < worker->end; i++) {
+            sim_receive(sim, i, step);
+        }
+        if (sim->num_workers > 1) {
+            pthread_barrier_wait(&sim->phase);
+        }
+    }
+}
+
+void *sim_worker(void *arg) {
+    sim_worker_t *worker = arg;
+    traffic_sim_t *sim = worker->sim;
+
+    pthread_mutex_lock(&sim->setup);
+    pthread_mutex_unlock(&sim->setup);
+    for (;;) {
+        pthread_barrier_wait(&sim->start);
+        if (sim->stop) {
+            break;
+        }
+        sim_run_band(sim, worker);
+        pthread_barrier_wait(&sim->done);
+    }
+    return NULL;
+}
+
+// Advances the simulated city; the caller is worker 0
+void sim_run(traffic_sim_t *sim, uint32_t seconds) {
+    sim->run_steps = seconds;
+    if (sim->num_workers > 1) {
+        pthread_barrier_wait(&sim->start);
+    }
+    sim_run_band(sim, &sim->workers[0]);
+    if (sim->num_workers > 1) {
+        pthread_barrier_wait(&sim->done);
+    }
+    sim->step += seconds;
+}
+
+// Edge approaches get traffic, the east-west arterials on every fourth row twice as much
+void sim_set_grid_demand(traffic_sim_t *sim, int cols, float peak_vph) {
+    for (int i = 0; i < sim->count; i++) {
+        for (int a = 0; a < NUM_APPROACHES; a++) {
+            bool arterial = (a & 1) && (i / cols) % 4 == 0;
+            sim->entry_vph[a][i] = sim->net->neighbor[a][i] < 0 ? peak_vph * (arterial ? 2.0f : 1.0f) : 0.0f;
+        }
+    }
+}
+
+uint64_t sim_state_hash(const traffic_sim_t *sim) {
+    uint64_t h = 0;
+    for (int i = 0; i < sim->count; i++) {
+        for (int a = 0; a < NUM_APPROACHES; a++) {
+            h = sim_hash(h ^ sim->queue[a][i]);
+        }
+        h = sim_hash(h ^ sim->exited[i] ^ (sim->waiting_s[i] << 20));
+    }
+    return h;
+}
+
+void sim_totals(const traffic_sim_t *sim, uint64_t *entered, uint64_t *exited, uint64_t *waiting_s, uint64_t *queued) {
+    *entered = *exited = *waiting_s = *queued = 0;
+    for (int i = 0; i < sim->count; i++) {
+        *entered += sim->entered[i];
+        *exited += sim->exited[i];
+        *waiting_s += sim->waiting_s[i];
+        for (int a = 0; a < NUM_APPROACHES; a++) {
+            *queued += sim->queue[a][i];
+        }
+    }
+}
+
+// The controller is intersection 0 of the simulated grid
+uint32_t sim_density(int approach) {
+    return sim.queue[approach][0];
+}
+
+float sim_flow(int intersection, int approach) {
+    return sim.flow_vph[approach][intersection];
+}
+
+// Per-approach greens become the two phases of intersection 0, keeping its offset
+void sim_set_light(int approach, int green_s) {
+    static int greens[NUM_APPROACHES];
+    greens[approach] = green_s < MIN_GREEN_S ? MIN_GREEN_S : green_s;
+    if (approach == NUM_APPROACHES - 1) {
+        sim.green_ns[0] = (int16_t)(greens[0] > greens[2] ? greens[0] : greens[2]);
+        sim.green_ew[0] = (int16_t)(greens[1] > greens[3] ? greens[1] : greens[3]);
+        sim.cycle_s[0] = (int16_t)(sim.green_ns[0] + sim.green_ew[0] + LOST_TIME_S);
+    }
+}
+
+void sim_send_plan(int intersection, int cycle_s, int offset_s, int green_ns, int green_ew) {
+    sim.cycle_s[intersection] = (int16_t)cycle_s;
+    sim.offset_s[intersection] = (int16_t)offset_s;
+    sim.green_ns[intersection] = (int16_t)green_ns;
+    sim.green_ew[intersection] = (int16_t)green_ew;
+}
+
+uint64_t sim_clock_us() {
+    return sim.step * 1000000ULL;
+}
+
+bool sim_none() {
+    return false;
+}
+
+void sim_ignore() {
+}
+
+void sim_send_log(const char *log) {
+    (void)log;
+}
+
+bool sim_manual_override(int *timings) {
+    (void)timings;
+    return false;
+}
+
+void print_sim_totals(const traffic_sim_t *sim) {
+    uint64_t entered, exited, waiting_s, queued;
+    sim_totals(sim, &entered, &exited, &waiting_s, &queued);
+    printf("Simulated %02u:%02u: %llu vehicles entered, %llu left, %llu queued, %.1f s average wait per trip\n",
+           sim->step % 86400 / 3600, sim->step % 3600 / 60, (unsigned long long)entered, (unsigned long long)exited,
+           (unsigned long long)queued, exited ? (double)waiting_s / exited : 0.0);
+}
+
+// The unchanged control loop, one cycle per simulated second, with sensors
+// and signals wired to a rows x cols city whose corner is this controller
+bool run_simulation(double hours, int rows, int cols) {
+    if (!(hours > 0.0 && hours <= SIM_MAX_HOURS)) {
+        printf("[ERROR] Simulated time must be above 0 and at most %d hours.\n", SIM_MAX_HOURS);
+        return false;
+    }
+    corridor_rows = rows;
+    corridor_cols = cols;
+    if (!init_system()) {
+        return false;
+    }
+    if (!sim_init(&sim, &network, SIM_SEED, (int)sysconf(_SC_NPROCESSORS_ONLN))) {
+        network_free(&network);
+        detector_ingest_free(&detectors);
+        return false;
+    }
+    sim_set_grid_demand(&sim, cols, SIM_PEAK_ENTRY_VPH);
+    sim.on_pulse = on_detector_pulse;
+    detector_density = false;
+    io = &sim_io;
+    cycle_count = 0;
+    cycle_log_period = SIM_LOG_PERIOD_S;
+
+    uint32_t seconds = (uint32_t)(hours * 3600.0);
+    uint64_t control_ns = 0, control_ns_max = 0, start_ns = monotonic_ns();
+    for (uint32_t s = 0; s < seconds; s++) {
+        uint64_t cycle_start = monotonic_ns();
+        control_cycle();
+        uint64_t ns = monotonic_ns() - cycle_start;
+        control_ns += ns;
+        control_ns_max = ns > control_ns_max ? ns : control_ns_max;
+        sim_run(&sim, 1);
+    }
+    double wall_s = (monotonic_ns() - start_ns) / 1e9;
+    print_sim_totals(&sim);
+    printf("Control loop: %u cycles, control_cycle avg %.3f ms max %.3f ms (%.1f of %.1f s), %.0f simulated s per wall s\n",
+           seconds, seconds ? control_ns / 1e6 / seconds : 0.0, control_ns_max / 1e6, control_ns / 1e9, wall_s,
+           wall_s > 0.0 ? seconds / wall_s : 0.0);
+    printf("Detector pulses: %llu aggregated, %llu dropped, %llu late\n", (unsigned long long)detectors.consumed,
+           (unsigned long long)atomic_load(&detectors.dropped), (unsigned long long)detectors.late);
+    io = &hardware_io;
+    cycle_log_period = 1;
+    sim_free(&sim);
+    network_free(&network);
+    detector_ingest_free(&detectors);
+    return true;
+}
+
+// 32x32 city from 07:00 for two simulated hours, re-planned every minute by
+// the corridor optimizer from the simulated GPS flows. The same seed at every
+// thread count must end in the same state.
+void run_sim_benchmark() {
+    const int side = 32;
+    const uint32_t seconds = 2 * 3600;
+    int max_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int thread_counts[] = {1, 2, 4, max_workers};
+
+    for (int t = 0; t < 4; t++) {
+        signal_network_t net;
+        traffic_sim_t city;
+
+        if (t == 3 && max_workers <= 4) {
+            break;
+        }
+        if (!network_build_grid(&net, side, side, BLOCK_TRAVEL_S, 1) || !sim_init(&city, &net, SIM_SEED, thread_counts[t])) {
+            return;
+        }
+        sim_set_grid_demand(&city, side, SIM_PEAK_ENTRY_VPH);
+
+        uint64_t start = monotonic_ns(), plan_ns = 0;
+        for (uint32_t s = 0; s < seconds; s += PLAN_INTERVAL_S) {
+            uint64_t plan_start = monotonic_ns();
+            for (int i = 0; i < net.count; i++) {
+                float flows[NUM_APPROACHES];
+                for (int a = 0; a < NUM_APPROACHES; a++) {
+                    flows[a] = city.flow_vph[a][i];
+                }
+                network_set_demand(&net, i, flows);
+            }
+            network_optimize(&net);
+            for (int i = 0; i < net.count; i++) {
+                city.cycle_s[i] = (int16_t)net.cycle_s;
+                city.offset_s[i] = (int16_t)net.offset[i];
+                city.green_ns[i] = (int16_t)net.green_ns[i];
+                city.green_ew[i] = (int16_t)net.green_ew[i];
+            }
+            plan_ns += monotonic_ns() - plan_start;
+            sim_run(&city, PLAN_INTERVAL_S);
+        }
+        double wall_s = (monotonic_ns() - start) / 1e9;
+        printf("%d threads: %u simulated s in %.2f s (planning %.2f s) = %.0f simulated s per wall s, a day in %.1f min, state %016llx\n",
+               thread_counts[t], seconds, wall_s, plan_ns / 1e9, seconds / wall_s, 86400 / (seconds / wall_s) / 60,
+               (unsigned long long)sim_state_hash(&city));
+        print_sim_totals(&city);
+        sim_free(&city);
+        network_free(&net);
+    }
+}
+
+void *ingest_producer(void *arg) {
+    ingest_producer_t *producer = arg;
+    uint64_t t_us = 0;
+
+    for (uint64_t e = (uint64_t)producer->index; e < INGEST_BENCH_PULSES; e += (uint64_t)producer->producers) {
+        if (producer->pulses % 256 == 0) {
+            t_us = monotonic_ns() / 1000;  // Drivers stamp in bursts too
+        }
+        while (!detector_push(producer->ingest, (uint32_t)(e % INGEST_BENCH_LANES), t_us, SIM_PULSE_ON_US)) {
+            sched_yield();
+        }
+        producer->pulses++;
+    }
+    return NULL;
+}
+
+// Load generator. First one core pushes a batch and drains it in turn, so the
+// rate covers queueing and aggregation together; every lane sees a vehicle
+// every 2 s for 400 ms, so its window must read 30 vehicles, 200 permille and
+// 2000 ms. Then producer threads push clock-stamped pulses while this thread
+// is the consumer. Every pulse must be counted exactly once.
+void run_ingest_benchmark() {
+    detector_ingest_t ingest;
+    int producer_counts[] = {1, 2, 4, MAX_INGEST_PRODUCERS};
+
+    if (!detector_ingest_init(&ingest, INGEST_BENCH_LANES)) {
+        return;
+    }
+    uint64_t start = monotonic_ns(), t_us = 0;
+    for (uint64_t e = 0; e < INGEST_BENCH_PULSES;) {
+        for (int b = 0; b < INGEST_BENCH_BATCH && e < INGEST_BENCH_PULSES; b++, e++) {
+            t_us = e * 2000000 / INGEST_BENCH_LANES;
+            detector_push(&ingest, (uint32_t)(e % INGEST_BENCH_LANES), t_us, SIM_PULSE_ON_US);
+        }
+        detector_drain(&ingest, INGEST_BENCH_BATCH);
+    }
+    double wall_s = (monotonic_ns() - start) / 1e9;
+    uint64_t counted = 0;
+    for (uint32_t l = 0; l < INGEST_BENCH_LANES; l++) {
+        counted += ingest.lanes[l].total;
+    }
+    detector_window_t window = detector_window(&ingest, 0, t_us);
+    printf("1 core: %d pulses over %d lanes in %.2f s = %.1f M pulses/s (%.1f ns each), %llu counted, %llu dropped, %llu late\n",
+           INGEST_BENCH_PULSES, INGEST_BENCH_LANES, wall_s, INGEST_BENCH_PULSES / wall_s / 1e6, wall_s * 1e9 / INGEST_BENCH_PULSES,
+           (unsigned long long)counted, (unsigned long long)atomic_load(&ingest.dropped), (unsigned long long)ingest.late);
+    printf("Lane 0 window: %u vehicles, %u permille occupied, %u ms headway\n",
+           window.count, window.occupancy_permille, window.headway_ms);
+    detector_ingest_free(&ingest);
+
+    for (int p = 0; p < 4; p++) {
+        ingest_producer_t producers[MAX_INGEST_PRODUCERS];
+        pthread_t threads[MAX_INGEST_PRODUCERS];
+        int count = producer_counts[p];
+
+        if (!detector_ingest_init(&ingest, INGEST_BENCH_LANES)) {
+            return;
+        }
+        // Producer k pushes every count-th pulse from k, so a producer that
+        // fails to start takes its share out of the expected total
+        int started = 0;
+        uint64_t expected = 0;
+        start = monotonic_ns();
+        for (int k = 0; k < count; k++) {
+            producers[k] = (ingest_producer_t){&ingest, k, count, 0};
+            if (pthread_create(&threads[k], NULL, ingest_producer, &producers[k]) != 0) {
+                printf("[WARN] Only %d of %d producers started.\n", started, count);
+                break;
+            }
+            started++;
+            expected += (INGEST_BENCH_PULSES - (uint64_t)k + (uint64_t)count - 1) / (uint64_t)count;
+        }
+        if (started == 0) {
+            detector_ingest_free(&ingest);
+            continue;
+        }
+        while (ingest.consumed < expected) {
+            if (detector_drain(&ingest, DETECTOR_QUEUE_SIZE) == 0) {
+                sched_yield();
+            }
+        }
+        for (int k = 0; k < started; k++) {
+            pthread_join(threads[k], NULL);
+        }
+        wall_s = (monotonic_ns() - start) / 1e9;
+        counted = 0;
+        for (uint32_t l = 0; l < INGEST_BENCH_LANES; l++) {
+            counted += ingest.lanes[l].total;
+        }
+        printf("%d producers: %.2f s = %.1f M pulses/s, %llu of %llu counted, queue full %llu times, %llu late\n",
+               started, wall_s, expected / wall_s / 1e6, (unsigned long long)counted, (unsigned long long)expected,
+               (unsigned long long)atomic_load(&ingest.dropped), (unsigned long long)ingest.late);
+        detector_ingest_free(&ingest);
+    }
+}
@@ -0,0 +1,402 @@
+// Asynchronous alert dispatcher with per-key coalescing
+//
+// Callers report the current state of an alert key ("zone7" in alarm or
+// clear) and return immediately; worker threads deliver it on every registered
+// channel (SMS, email, ...). Each key and channel has at most one job queued:
+//   - reporting the state the channel already has is a no-op, so a condition
+//     that stays active notifies once, not once per control cycle
+//   - changes made while a job is queued or being sent fold into that job,
+//     and a change back to the delivered state cancels it
+//   - an alarm goes out as soon as a worker is free; a clear waits until
+//     window_ms after the previous delivery, so a flapping input produces one
+//     clear per window and the alarm that follows it carries the latest
+//     details and how many changes it covers
+// Ready jobs go out alarms first, then clears, oldest first. A failed
+// delivery is retried with exponential backoff up to ALERT_MAX_ATTEMPTS times,
+// then counted as failed and retried once per window, alarms included.
+
+#ifndef ALERT_DISPATCHER_H
+#define ALERT_DISPATCHER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define ALERT_MAX_KEY 32
+#define ALERT_MAX_MESSAGE 256
+#define ALERT_MAX_CHANNELS 4
+#define ALERT_MAX_WORKERS 32
+#define ALERT_RETRY_BASE_MS 1000  // Doubles per failed attempt
+#define ALERT_MAX_ATTEMPTS 6
+#define ALERT_LATENCY_SAMPLES 8192
+
+// changes: state changes folded into this delivery, 1 unless the key flapped
+typedef bool (*alert_sink_fn)(const char *key, bool active, const char *message, uint32_t changes, void *ctx);
+
+typedef enum {
+    JOB_IDLE,
+    JOB_DELAYED,              // Waiting out the window or a retry backoff
+    JOB_READY,
+    JOB_SENDING
+} alert_job_state_t;
+
+// One per key and channel, at index key * ALERT_MAX_CHANNELS + channel
+typedef struct {
+    alert_job_state_t state;
+    bool delivered;           // State the channel last confirmed, clear initially
+    bool ever_delivered;
+    bool gave_up;             // Last attempt ran out of retries
+    uint8_t priority;         // 0 alarm, 1 clear
+    uint32_t attempts;
+    uint32_t changes;         // Since the last delivery
+    uint64_t seq;
+    uint64_t not_before_ms;
+    uint64_t last_delivery_ms;
+    uint64_t requested_ms;    // When the pending change was first reported
+} alert_job_t;
+
+typedef struct {
+    char name[ALERT_MAX_KEY];  // Empty when the slot is free
+    bool active;
+    char message[ALERT_MAX_MESSAGE];
+} alert_key_t;
+
+typedef struct {
+    const char *name;
+    alert_sink_fn sink;
+    void *ctx;
+} alert_channel_t;
+
+typedef struct {
+    uint32_t *items;          // One entry per job
+    uint32_t count;
+} alert_heap_t;
+
+typedef struct {
+    uint32_t window_ms;
+    alert_channel_t channels[ALERT_MAX_CHANNELS];
+    int num_channels;
+    uint32_t key_slots;       // Power of two, at least twice the expected keys; keys are never removed
+    alert_key_t *keys;
+    alert_job_t *jobs;        // key_slots * ALERT_MAX_CHANNELS
+    alert_heap_t ready, delayed;
+    uint64_t next_seq;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;      // CLOCK_MONOTONIC
+    pthread_t workers[ALERT_MAX_WORKERS];
+    int num_workers;
+    _Atomic bool running;     // Read by raising threads without the lock
+    bool stop;
+    uint64_t raised, deduplicated, coalesced, cancelled, delivered, retries, failed, dropped;
+    uint32_t latency_ms[ALERT_LATENCY_SAMPLES];  // Report to confirmed delivery
+    uint32_t latency_samples;
+} alert_dispatcher_t;
+
+static inline uint64_t alert_clock_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+static inline bool alert_job_before(const alert_dispatcher_t *d, const alert_heap_t *heap, uint32_t a, uint32_t b) {
+    const alert_job_t *x = &d->jobs[a], *y = &d->jobs[b];
+    if (heap == &d->delayed && x->not_before_ms != y->not_before_ms) {
+        return x->not_before_ms < y->not_before_ms;
+    }
+    if (heap == &d->ready && x->priority != y->priority) {
+        return x->priority < y->priority;
+    }
+    return x->seq < y->seq;
+}
+
+static inline void alert_heap_push(alert_dispatcher_t *d, alert_heap_t *heap, uint32_t job) {
+    uint32_t i = heap->count++;
+    while (i > 0 && alert_job_before(d, heap, job, heap->items[(i - 1) / 2])) {
+        heap->items[i] = heap->items[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap->items[i] = job;
+}
+
+static inline uint32_t alert_heap_pop(alert_dispatcher_t *d, alert_heap_t *heap) {
+    uint32_t top = heap->items[0];
+    uint32_t last = heap->items[--heap->count];
+    uint32_t i = 0;
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= heap->count) {
+            break;
+        }
+        if (child + 1 < heap->count && alert_job_before(d, heap, heap->items[child + 1], heap->items[child])) {
+            child++;
+        }
+        if (!alert_job_before(d, heap, heap->items[child], last)) {
+            break;
+        }
+        heap->items[i] = heap->items[child];
+        i = child;
+    }
+    if (heap->count) {
+        heap->items[i] = last;
+    }
+    return top;
+}
+
+// Queues an idle job whose channel is behind its key; called with the lock held
+static inline void alert_schedule(alert_dispatcher_t *d, uint32_t index, uint64_t now_ms) {
+    alert_job_t *job = &d->jobs[index];
+    const alert_key_t *key = &d->keys[index / ALERT_MAX_CHANNELS];
+
+    if (job->state != JOB_IDLE || key->active == job->delivered) {
+        return;
+    }
+    job->priority = key->active ? 0 : 1;
+    job->seq = d->next_seq++;
+    job->not_before_ms = now_ms;
+    if (job->ever_delivered && (!key->active || job->gave_up)) {
+        job->not_before_ms = job->last_delivery_ms + d->window_ms;
+    }
+    if (job->not_before_ms > now_ms) {
+        job->state = JOB_DELAYED;
+        alert_heap_push(d, &d->delayed, index);
+    } else {
+        job->state = JOB_READY;
+        alert_heap_push(d, &d->ready, index);
+    }
+    pthread_cond_signal(&d->wake);
+}
+
+static inline int alert_key_find(alert_dispatcher_t *d, const char *name) {
+    uint32_t hash = 2166136261u;
+    for (const char *p = name; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    for (uint32_t n = 0; n < d->key_slots; n++) {
+        uint32_t slot = (hash + n) & (d->key_slots - 1);
+        alert_key_t *key = &d->keys[slot];
+        if (key->name[0] == '\0') {
+            snprintf(key->name, sizeof(key->name), "%s", name);
+            return (int)slot;
+        }
+        if (strncmp(key->name, name, sizeof(key->name) - 1) == 0) {
+            return (int)slot;
+        }
+    }
+    return -1;
+}
+
+// Never blocks on delivery; returns false only when the key table is full
+static inline bool alert_raise(alert_dispatcher_t *d, const char *name, bool active, const char *message) {
+    uint64_t now_ms = alert_clock_ms();
+
+    pthread_mutex_lock(&d->lock);
+    int slot = alert_key_find(d, name);
+    if (slot < 0) {
+        d->dropped++;
+        pthread_mutex_unlock(&d->lock);
+        return false;
+    }
+    alert_key_t *key = &d->keys[slot];
+    snprintf(key->message, sizeof(key->message), "%s", message);  // Latest details go out with whatever is sent next
+    if (key->active == active) {
+        d->deduplicated++;
+        pthread_mutex_unlock(&d->lock);
+        return true;
+    }
+    key->active = active;
+    d->raised++;
+    for (int c = 0; c < d->num_channels; c++) {
+        uint32_t index = (uint32_t)slot * ALERT_MAX_CHANNELS + (uint32_t)c;
+        alert_job_t *job = &d->jobs[index];
+        if (job->changes++ == 0) {
+            job->requested_ms = now_ms;
+        }
+        if (job->state == JOB_IDLE) {
+            alert_schedule(d, index, now_ms);
+        } else {
+            d->coalesced++;  // Stale jobs are dropped when they reach a worker
+        }
+    }
+    pthread_mutex_unlock(&d->lock);
+    return true;
+}
+
+static inline void *alert_worker_thread(void *arg) {
+    alert_dispatcher_t *d = arg;
+    char name[ALERT_MAX_KEY], message[ALERT_MAX_MESSAGE];
+
+    pthread_mutex_lock(&d->lock);
+    while (!d->stop) {
+        uint64_t now_ms = alert_clock_ms();
+        while (d->delayed.count && d->jobs[d->delayed.items[0]].not_before_ms <= now_ms) {
+            uint32_t index = alert_heap_pop(d, &d->delayed);
+            d->jobs[index].state = JOB_READY;
+            alert_heap_push(d, &d->ready, index);
+        }
+        if (!d->ready.count) {
+            if (d->delayed.count) {
+                uint64_t wake_ms = d->jobs[d->delayed.items[0]].not_before_ms;
+                struct timespec deadline = {(time_t)(wake_ms / 1000), (long)(wake_ms % 1000) * 1000000L};
+                pthread_cond_timedwait(&d->wake, &d->lock, &deadline);
+            } else {
+                pthread_cond_wait(&d->wake, &d->lock);
+            }
+            continue;
+        }
+
+        uint32_t index = alert_heap_pop(d, &d->ready);
+        alert_job_t *job = &d->jobs[index];
+        const alert_key_t *key = &d->keys[index / ALERT_MAX_CHANNELS];
+        const alert_channel_t *channel = &d->channels[index % ALERT_MAX_CHANNELS];
+        if (key->active == job->delivered) {
+            job->state = JOB_IDLE;  // Changed back before it went out
+            job->changes = 0;
+            job->attempts = 0;
+            d->cancelled++;
+            continue;
+        }
+        bool active = key->active;
+        uint32_t changes = job->changes;
+        memcpy(name, key->name, sizeof(name));
+        memcpy(message, key->message, sizeof(message));
+        job->state = JOB_SENDING;
+        pthread_mutex_unlock(&d->lock);
+
+        bool ok = channel->sink(name, active, message, changes, channel->ctx);
+
+        pthread_mutex_lock(&d->lock);
+        now_ms = alert_clock_ms();
+        if (ok || ++job->attempts >= ALERT_MAX_ATTEMPTS) {
+            if (ok) {
+                if (d->latency_samples < ALERT_LATENCY_SAMPLES) {
+                    d->latency_ms[d->latency_samples++] = (uint32_t)(now_ms - job->requested_ms);
+                }
+                job->delivered = active;
+                job->changes -= changes;
+                job->requested_ms = now_ms;
+                d->delivered++;
+            } else {
+                d->failed++;  // Out of retries; tried again once per window from here
+            }
+            job->gave_up = !ok;
+            job->ever_delivered = true;
+            job->last_delivery_ms = now_ms;
+            job->attempts = 0;
+            job->state = JOB_IDLE;
+            alert_schedule(d, index, now_ms);  // Key changed while sending, or still undelivered
+        } else {
+            d->retries++;
+            job->not_before_ms = now_ms + ((uint64_t)ALERT_RETRY_BASE_MS << (job->attempts - 1));
+            job->state = JOB_DELAYED;
+            alert_heap_push(d, &d->delayed, index);
+        }
+    }
+    pthread_mutex_unlock(&d->lock);
+    return NULL;
+}
+
+// max_keys is how many distinct keys callers will raise; the table is sized
+// so lookups stay short when all of them are in use
+static inline bool alert_dispatcher_init(alert_dispatcher_t *d, uint32_t window_ms, uint32_t max_keys) {
+    pthread_condattr_t attr;
+
+    memset(d, 0, sizeof(*d));
+    d->key_slots = 16;
+    while (d->key_slots < 2 * max_keys) {
+        d->key_slots *= 2;
+    }
+    uint32_t jobs = d->key_slots * ALERT_MAX_CHANNELS;
+    d->keys = calloc(d->key_slots, sizeof(alert_key_t));
+    d->jobs = calloc(jobs, sizeof(alert_job_t));
+    d->ready.items = malloc(jobs * sizeof(uint32_t));
+    d->delayed.items = malloc(jobs * sizeof(uint32_t));
+    if (!d->keys || !d->jobs || !d->ready.items || !d->delayed.items) {
+        printf("[ERROR] Out of memory for %u alert keys.\n", max_keys);
+        free(d->keys);
+        free(d->jobs);
+        free(d->ready.items);
+        free(d->delayed.items);
+        memset(d, 0, sizeof(*d));
+        return false;
+    }
+    d->window_ms = window_ms;
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&d->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    return true;
+}
+
+// Channels are registered before the workers start
+static inline bool alert_dispatcher_add_channel(alert_dispatcher_t *d, const char *name, alert_sink_fn sink, void *ctx) {
+    if (d->num_channels == ALERT_MAX_CHANNELS) {
+        printf("[ERROR] Too many alert channels, %s not added.\n", name);
+        return false;
+    }
+    d->channels[d->num_channels].name = name;
+    d->channels[d->num_channels].sink = sink;
+    d->channels[d->num_channels].ctx = ctx;
+    d->num_channels++;
+    return true;
+}
+
+// Runs with as many workers as could be started; false when none could, in
+// which case the dispatcher stays stopped and only needs alert_dispatcher_free
+static inline bool alert_dispatcher_start(alert_dispatcher_t *d, int workers) {
+    int wanted = workers < ALERT_MAX_WORKERS ? workers : ALERT_MAX_WORKERS;
+    d->num_workers = 0;
+    while (d->num_workers < wanted && pthread_create(&d->workers[d->num_workers], NULL, alert_worker_thread, d) == 0) {
+        d->num_workers++;
+    }
+    if (d->num_workers == 0) {
+        printf("[ERROR] Could not start any alert worker.\n");
+        return false;
+    }
+    if (d->num_workers < wanted) {
+        printf("[WARN] Only %d of %d alert workers started.\n", d->num_workers, wanted);
+    }
+    atomic_store_explicit(&d->running, true, memory_order_release);
+    return true;
+}
+
+// True once every channel has caught up with its keys or given up on them
+static inline bool alert_dispatcher_idle(alert_dispatcher_t *d) {
+    pthread_mutex_lock(&d->lock);
+    bool idle = true;
+    for (uint32_t i = 0; idle && i < d->key_slots * ALERT_MAX_CHANNELS; i++) {
+        idle = d->jobs[i].state == JOB_IDLE;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return idle;
+}
+
+// Jobs still queued are abandoned
+static inline void alert_dispatcher_stop(alert_dispatcher_t *d) {
+    pthread_mutex_lock(&d->lock);
+    d->stop = true;
+    pthread_cond_broadcast(&d->wake);
+    pthread_mutex_unlock(&d->lock);
+    for (int i = 0; i < d->num_workers; i++) {
+        pthread_join(d->workers[i], NULL);
+    }
+    atomic_store_explicit(&d->running, false, memory_order_release);
+}
+
+// After alert_dispatcher_stop
+static inline void alert_dispatcher_free(alert_dispatcher_t *d) {
+    pthread_mutex_destroy(&d->lock);
+    pthread_cond_destroy(&d->wake);
+    free(d->keys);
+    free(d->jobs);
+    free(d->ready.items);
+    free(d->delayed.items);
+    memset(d, 0, sizeof(*d));
+}
+
+#endif
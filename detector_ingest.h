@@ -0,0 +1,199 @@
+// Detector pulse ingestion with per-lane sliding windows
+//
+// Loop and camera drivers report every vehicle as a pulse: lane, time of the
+// leading edge and how long the vehicle sat on the detector. Any number of
+// producer threads push pulses into a bounded lock-free queue (one CAS per
+// pulse, nothing blocks); a single consumer drains it and folds each pulse
+// into its lane's ring of one-second buckets. A window query sums the last
+// DETECTOR_WINDOW_BUCKETS buckets into vehicle count, occupancy and mean
+// headway. Memory is fixed at init: the queue plus one ring per lane.
+//
+// Buckets are keyed by pulse time, not arrival order, so pulses reordered
+// between producers land in the right second; pulses older than the window
+// are counted as late and dropped. Each bucket keeps its earliest and latest
+// leading edge, so mean headway is computed at query time from the vehicles
+// inside the window only, whatever order they arrived in.
+
+#ifndef DETECTOR_INGEST_H
+#define DETECTOR_INGEST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#define DETECTOR_QUEUE_SIZE 65536       // Power of two
+#define DETECTOR_MAX_LANES 4096
+#define DETECTOR_BUCKET_US 1000000ULL
+#define DETECTOR_WINDOW_BUCKETS 60      // 60 s window
+
+typedef struct {
+    uint64_t t_us;            // Leading edge
+    uint32_t lane;
+    uint32_t on_us;           // Time the vehicle occupied the detector
+} detector_pulse_t;
+
+// seq == position when the slot is free for that enqueue, position + 1 once
+// it holds that pulse
+typedef struct {
+    _Atomic uint64_t seq;
+    detector_pulse_t pulse;
+} detector_slot_t;
+
+typedef struct {
+    uint32_t epoch;           // Second (t_us / DETECTOR_BUCKET_US) this bucket holds
+    uint32_t count;
+    uint64_t on_us;
+    uint64_t first_us, last_us;  // Earliest and latest leading edge
+} detector_bucket_t;
+
+typedef struct {
+    detector_bucket_t buckets[DETECTOR_WINDOW_BUCKETS];
+    uint64_t total;
+} detector_lane_t;
+
+typedef struct {
+    uint32_t count;           // Vehicles in the window
+    uint32_t occupancy_permille;
+    uint32_t headway_ms;      // Mean gap between leading edges in the window, 0 below two vehicles
+} detector_window_t;
+
+typedef struct {
+    detector_slot_t *slots;
+    _Alignas(64) _Atomic uint64_t tail;  // Next position producers claim
+    _Alignas(64) _Atomic uint64_t dropped;
+    _Alignas(64) uint64_t head;          // Consumer only from here on
+    detector_lane_t *lanes;
+    uint32_t num_lanes;
+    uint64_t consumed, late, bad_lane;
+} detector_ingest_t;
+
+static inline bool detector_ingest_init(detector_ingest_t *ingest, uint32_t lanes) {
+    memset(ingest, 0, sizeof(*ingest));
+    if (lanes == 0 || lanes > DETECTOR_MAX_LANES) {
+        printf("[ERROR] Detector lane count %u out of range.\n", lanes);
+        return false;
+    }
+    ingest->slots = aligned_alloc(64, DETECTOR_QUEUE_SIZE * sizeof(detector_slot_t));
+    ingest->lanes = calloc(lanes, sizeof(detector_lane_t));
+    if (!ingest->slots || !ingest->lanes) {
+        printf("[ERROR] Out of memory for %u detector lanes.\n", lanes);
+        free(ingest->slots);
+        free(ingest->lanes);
+        return false;
+    }
+    for (uint64_t i = 0; i < DETECTOR_QUEUE_SIZE; i++) {
+        atomic_init(&ingest->slots[i].seq, i);
+    }
+    ingest->num_lanes = lanes;
+    return true;
+}
+
+static inline void detector_ingest_free(detector_ingest_t *ingest) {
+    free(ingest->slots);
+    free(ingest->lanes);
+    memset(ingest, 0, sizeof(*ingest));
+}
+
+// Any thread; returns false when the queue is full and the pulse is dropped
+static inline bool detector_push(detector_ingest_t *ingest, uint32_t lane, uint64_t t_us, uint32_t on_us) {
+    uint64_t pos = atomic_load_explicit(&ingest->tail, memory_order_relaxed);
+    detector_slot_t *slot;
+
+    for (;;) {
+        slot = &ingest->slots[pos & (DETECTOR_QUEUE_SIZE - 1)];
+        uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int64_t diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ingest->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&ingest->dropped, 1, memory_order_relaxed);
+            return false;
+        } else {
+            pos = atomic_load_explicit(&ingest->tail, memory_order_relaxed);  // Another producer took it
+        }
+    }
+    slot->pulse.t_us = t_us;
+    slot->pulse.lane = lane;
+    slot->pulse.on_us = on_us;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+static inline void detector_record(detector_ingest_t *ingest, const detector_pulse_t *pulse) {
+    if (pulse->lane >= ingest->num_lanes) {
+        ingest->bad_lane++;
+        return;
+    }
+    detector_lane_t *lane = &ingest->lanes[pulse->lane];
+    uint32_t epoch = (uint32_t)(pulse->t_us / DETECTOR_BUCKET_US);
+    detector_bucket_t *bucket = &lane->buckets[epoch % DETECTOR_WINDOW_BUCKETS];
+
+    if (bucket->epoch != epoch) {
+        if (epoch < bucket->epoch) {
+            ingest->late++;  // Its second has already been reused
+            return;
+        }
+        memset(bucket, 0, sizeof(*bucket));
+        bucket->epoch = epoch;
+    }
+    if (bucket->count == 0 || pulse->t_us < bucket->first_us) {
+        bucket->first_us = pulse->t_us;
+    }
+    if (bucket->count == 0 || pulse->t_us > bucket->last_us) {
+        bucket->last_us = pulse->t_us;
+    }
+    bucket->count++;
+    bucket->on_us += pulse->on_us;
+    lane->total++;
+}
+
+// Consumer thread only; aggregates up to max pulses and returns how many
+static inline uint32_t detector_drain(detector_ingest_t *ingest, uint32_t max) {
+    uint32_t n = 0;
+
+    while (n < max) {
+        detector_slot_t *slot = &ingest->slots[ingest->head & (DETECTOR_QUEUE_SIZE - 1)];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != ingest->head + 1) {
+            break;
+        }
+        detector_pulse_t pulse = slot->pulse;
+        atomic_store_explicit(&slot->seq, ingest->head + DETECTOR_QUEUE_SIZE, memory_order_release);
+        ingest->head++;
+        detector_record(ingest, &pulse);
+        n++;
+    }
+    ingest->consumed += n;
+    return n;
+}
+
+// The window ending with the second that contains now_us; consumer thread only.
+// The gaps between consecutive leading edges add up to last - first, so the
+// mean headway needs only the window's extremes.
+static inline detector_window_t detector_window(const detector_ingest_t *ingest, uint32_t lane, uint64_t now_us) {
+    detector_window_t window = {0, 0, 0};
+    uint32_t now_epoch = (uint32_t)(now_us / DETECTOR_BUCKET_US);
+    uint64_t on_us = 0, first_us = UINT64_MAX, last_us = 0;
+
+    if (lane >= ingest->num_lanes) {
+        return window;
+    }
+    for (int b = 0; b < DETECTOR_WINDOW_BUCKETS; b++) {
+        const detector_bucket_t *bucket = &ingest->lanes[lane].buckets[b];
+        if (bucket->count && bucket->epoch <= now_epoch && now_epoch - bucket->epoch < DETECTOR_WINDOW_BUCKETS) {
+            window.count += bucket->count;
+            on_us += bucket->on_us;
+            first_us = bucket->first_us < first_us ? bucket->first_us : first_us;
+            last_us = bucket->last_us > last_us ? bucket->last_us : last_us;
+        }
+    }
+    window.occupancy_permille = (uint32_t)(on_us * 1000 / (DETECTOR_WINDOW_BUCKETS * DETECTOR_BUCKET_US));
+    window.headway_ms = window.count > 1 ? (uint32_t)((last_us - first_us) / (window.count - 1) / 1000) : 0;
+    return window;
+}
+
+#endif
@@ -0,0 +1,541 @@
+// Table-driven threshold rules with hysteresis and debounce
+//
+// Rule file, one rule per line, '#' starts a comment:
+//   <input> <op> <threshold> [hysteresis <h>] [debounce <ms>] -> <output>[, <output>...]
+// op is '>' or '<'. A '>' rule turns active once its input has stayed above the
+// threshold for the debounce time, and inactive once it has stayed at or below
+// threshold - hysteresis for as long; '<' is the mirror image. An output is on
+// while any rule naming it is active, and the engine only reports transitions.
+//
+// Rules are compiled into one flat array plus a per-input index, so an input
+// update touches only the rules that read it. Reloading compiles a new table
+// and swaps it in; rules that survive the edit keep their state.
+//
+// Inputs must be registered before rules naming them are compiled. Outputs are
+// created on demand by the rules, and each one is reported once when it first
+// appears, whatever its state.
+
+#ifndef RULE_ENGINE_H
+#define RULE_ENGINE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#define RULE_MAX_NAME 32
+#define RULE_MAX_NAMES 16384      // Default inputs or outputs per engine
+#define RULE_MAX_LINE 256
+
+typedef struct {
+    float trip;               // Crossing this starts activation
+    float release;            // Crossing back past this starts deactivation
+    uint32_t debounce_ms;
+    uint32_t pending_since_ms;
+    uint32_t input;
+    uint32_t first_output;    // Index into rule_table_t.rule_outputs
+    uint16_t num_outputs;
+    uint8_t greater;          // '>' rule
+    uint8_t active;
+    uint8_t pending;          // Condition for the opposite state currently holds
+    uint8_t queued;           // In the engine's pending list
+} rule_t;
+
+typedef struct {
+    rule_t *rules;
+    uint32_t num_rules;
+    uint32_t *rule_outputs;
+    uint32_t num_inputs;      // Inputs known when the table was compiled
+    uint32_t *by_input_start; // Rules reading input i are by_input[start[i] .. start[i + 1])
+    uint32_t *by_input;
+} rule_table_t;
+
+typedef struct {
+    char (*names)[RULE_MAX_NAME];
+    int32_t *slots;           // Name index + 1, 0 when empty
+    uint32_t count, capacity;
+    uint32_t mask;            // Hash slots - 1, slots >= 2 * capacity
+} rule_names_t;
+
+typedef struct rule_engine rule_engine_t;
+typedef void (*rule_output_fn)(rule_engine_t *engine, int output, bool on, void *ctx);
+// Optional rewrite of loaded rule text (e.g. template expansion); returns a malloc'd string
+typedef char *(*rule_expand_fn)(rule_engine_t *engine, const char *text);
+
+struct rule_engine {
+    rule_table_t *table;
+    rule_names_t inputs, outputs;
+    float *values;            // Last value per input, NAN until seen
+    uint32_t *votes;          // Active rules per output
+    bool *output_on;
+    uint32_t announced;       // Outputs whose initial state has been reported
+    uint32_t *pending;        // Rules waiting out a debounce
+    uint32_t num_pending;
+    rule_output_fn on_output;
+    rule_expand_fn expand;
+    void *owner;              // For the program's callbacks
+    bool quiet;               // No load summary, for programs running many engines
+    const char *path;
+    const char *defaults;     // Used when the rule file is missing
+    time_t mtime;
+    uint64_t updates, evaluations, transitions;
+};
+
+static inline uint32_t rule_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash = (hash ^ (uint8_t)*name++) * 16777619u;
+    }
+    return hash;
+}
+
+// Returns the name's index, adding it if create is set; -1 if absent or full
+static inline int rule_names_find(rule_names_t *table, const char *name, bool create) {
+    uint32_t slot = rule_hash(name) & table->mask;
+    while (table->slots[slot]) {
+        int index = table->slots[slot] - 1;
+        if (strcmp(table->names[index], name) == 0) {
+            return index;
+        }
+        slot = (slot + 1) & table->mask;
+    }
+    if (!create || table->count == table->capacity || strlen(name) >= RULE_MAX_NAME) {
+        return -1;
+    }
+    strcpy(table->names[table->count], name);
+    table->slots[slot] = (int32_t)table->count + 1;
+    return (int)table->count++;
+}
+
+// Forgets every name from index count on, rebuilding the hash slots
+static inline void rule_names_truncate(rule_names_t *table, uint32_t count) {
+    if (count >= table->count) {
+        return;
+    }
+    table->count = count;
+    memset(table->slots, 0, (table->mask + 1) * sizeof(int32_t));
+    for (uint32_t index = 0; index < count; index++) {
+        uint32_t slot = rule_hash(table->names[index]) & table->mask;
+        while (table->slots[slot]) {
+            slot = (slot + 1) & table->mask;
+        }
+        table->slots[slot] = (int32_t)index + 1;
+    }
+}
+
+static inline bool rule_names_init(rule_names_t *table, uint32_t capacity) {
+    uint32_t slots = 2;
+    while (slots < 2 * capacity) {
+        slots <<= 1;
+    }
+    table->names = calloc(capacity, RULE_MAX_NAME);
+    table->slots = calloc(slots, sizeof(int32_t));
+    table->capacity = capacity;
+    table->mask = slots - 1;
+    return table->names && table->slots;
+}
+
+// max_names bounds both inputs and outputs; RULE_MAX_NAMES suits one engine per program
+static inline bool rule_engine_init(rule_engine_t *engine, rule_output_fn on_output, uint32_t max_names) {
+    memset(engine, 0, sizeof(*engine));
+    engine->on_output = on_output;
+    bool names_ok = rule_names_init(&engine->inputs, max_names) && rule_names_init(&engine->outputs, max_names);
+    engine->values = malloc(max_names * sizeof(float));
+    engine->votes = calloc(max_names, sizeof(uint32_t));
+    engine->output_on = calloc(max_names, sizeof(bool));
+    if (!names_ok || !engine->values || !engine->votes || !engine->output_on) {
+        printf("[ERROR] Rule engine: out of memory.\n");
+        return false;
+    }
+    for (uint32_t i = 0; i < max_names; i++) {
+        engine->values[i] = NAN;
+    }
+    return true;
+}
+
+// Inputs are registered by the program; rules may only read registered inputs
+static inline int rule_engine_input(rule_engine_t *engine, const char *name) {
+    return rule_names_find(&engine->inputs, name, true);
+}
+
+static inline int rule_engine_output(rule_engine_t *engine, const char *name) {
+    return rule_names_find(&engine->outputs, name, true);
+}
+
+static inline const char *rule_engine_output_name(const rule_engine_t *engine, int output) {
+    return engine->outputs.names[output];
+}
+
+static inline bool rule_engine_output_state(const rule_engine_t *engine, int output) {
+    return output >= 0 && engine->output_on[output];
+}
+
+static inline void rule_table_free(rule_table_t *table) {
+    if (table) {
+        free(table->rules);
+        free(table->rule_outputs);
+        free(table->by_input_start);
+        free(table->by_input);
+        free(table);
+    }
+}
+
+static inline void rule_engine_free(rule_engine_t *engine) {
+    rule_table_free(engine->table);
+    free(engine->inputs.names);
+    free(engine->inputs.slots);
+    free(engine->outputs.names);
+    free(engine->outputs.slots);
+    free(engine->values);
+    free(engine->votes);
+    free(engine->output_on);
+    free(engine->pending);
+    engine->table = NULL;
+}
+
+static inline char *rule_trim(char *s) {
+    while (*s == ' ' || *s == '\t') {
+        s++;
+    }
+    char *end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n')) {
+        *--end = '\0';
+    }
+    return s;
+}
+
+// Drops a half-built table and the outputs it created, which no installed
+// table names yet
+static inline rule_table_t *rule_compile_fail(rule_engine_t *engine, rule_table_t *table, uint32_t outputs_before) {
+    rule_table_free(table);
+    rule_names_truncate(&engine->outputs, outputs_before);
+    return NULL;
+}
+
+// Parses rule text into a new table; prints the offending line and returns
+// NULL on any error so a bad edit never replaces a working table
+static inline rule_table_t *rule_engine_compile(rule_engine_t *engine, const char *text, const char *source) {
+    uint32_t max_rules = 1, max_outputs = 1;
+    uint32_t outputs_before = engine->outputs.count;
+    for (const char *p = text; *p; p++) {
+        max_rules += *p == '\n';
+        max_outputs += *p == '\n' || *p == ',';
+    }
+
+    rule_table_t *table = calloc(1, sizeof(rule_table_t));
+    if (!table) {
+        return NULL;
+    }
+    table->rules = calloc(max_rules, sizeof(rule_t));
+    table->rule_outputs = malloc(max_outputs * sizeof(uint32_t));
+    if (!table->rules || !table->rule_outputs) {
+        return rule_compile_fail(engine, table, outputs_before);
+    }
+
+    uint32_t num_outputs = 0;
+    int line_no = 0;
+    for (const char *p = text; *p;) {
+        char line[RULE_MAX_LINE];
+        const char *end = strchr(p, '\n');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        line_no++;
+        if (len >= sizeof(line)) {
+            printf("[ERROR] %s:%d: line too long.\n", source, line_no);
+            return rule_compile_fail(engine, table, outputs_before);
+        }
+        memcpy(line, p, len);
+        line[len] = '\0';
+        p += len + (end != NULL);
+
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+        char *body = rule_trim(line);
+        if (*body == '\0') {
+            continue;
+        }
+
+        char *arrow = strstr(body, "->");
+        char input[RULE_MAX_NAME], op[4], key[16];
+        float threshold, hysteresis = 0.0f, number;
+        uint32_t debounce_ms = 0;
+        int used;
+        if (!arrow) {
+            printf("[ERROR] %s:%d: missing '->'.\n", source, line_no);
+            return rule_compile_fail(engine, table, outputs_before);
+        }
+        *arrow = '\0';
+        if (sscanf(body, "%31s %3s %f%n", input, op, &threshold, &used) != 3 || (strcmp(op, ">") != 0 && strcmp(op, "<") != 0)) {
+            printf("[ERROR] %s:%d: expected '<input> <op> <threshold>'.\n", source, line_no);
+            return rule_compile_fail(engine, table, outputs_before);
+        }
+        for (char *opt = body + used; sscanf(opt, "%15s %f%n", key, &number, &used) == 2; opt += used) {
+            if (strcmp(key, "hysteresis") == 0 && number >= 0.0f) {
+                hysteresis = number;
+            } else if (strcmp(key, "debounce") == 0 && number >= 0.0f) {
+                debounce_ms = (uint32_t)number;
+            } else {
+                printf("[ERROR] %s:%d: unknown option '%s'.\n", source, line_no, key);
+                return rule_compile_fail(engine, table, outputs_before);
+            }
+        }
+
+        int input_id = rule_names_find(&engine->inputs, input, false);
+        if (input_id < 0) {
+            printf("[ERROR] %s:%d: unknown input '%s'.\n", source, line_no, input);
+            return rule_compile_fail(engine, table, outputs_before);
+        }
+
+        rule_t *rule = &table->rules[table->num_rules];
+        rule->input = (uint32_t)input_id;
+        rule->greater = op[0] == '>';
+        rule->trip = threshold;
+        rule->release = rule->greater ? threshold - hysteresis : threshold + hysteresis;
+        rule->debounce_ms = debounce_ms;
+        rule->first_output = num_outputs;
+        char *save;
+        for (char *name = strtok_r(arrow + 2, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+            int output = rule_engine_output(engine, rule_trim(name));
+            if (output < 0) {
+                printf("[ERROR] %s:%d: bad output name.\n", source, line_no);
+                return rule_compile_fail(engine, table, outputs_before);
+            }
+            table->rule_outputs[num_outputs++] = (uint32_t)output;
+            rule->num_outputs++;
+        }
+        if (rule->num_outputs == 0) {
+            printf("[ERROR] %s:%d: rule has no outputs.\n", source, line_no);
+            return rule_compile_fail(engine, table, outputs_before);
+        }
+        table->num_rules++;
+    }
+
+    // Counting sort of rule indices by input
+    table->num_inputs = engine->inputs.count;
+    table->by_input_start = calloc(table->num_inputs + 1, sizeof(uint32_t));
+    table->by_input = malloc((table->num_rules + 1) * sizeof(uint32_t));
+    if (!table->by_input_start || !table->by_input) {
+        return rule_compile_fail(engine, table, outputs_before);
+    }
+    for (uint32_t r = 0; r < table->num_rules; r++) {
+        table->by_input_start[table->rules[r].input + 1]++;
+    }
+    for (uint32_t i = 0; i < table->num_inputs; i++) {
+        table->by_input_start[i + 1] += table->by_input_start[i];
+    }
+    uint32_t *fill = malloc((table->num_inputs + 1) * sizeof(uint32_t));
+    if (!fill) {
+        return rule_compile_fail(engine, table, outputs_before);
+    }
+    memcpy(fill, table->by_input_start, (table->num_inputs + 1) * sizeof(uint32_t));
+    for (uint32_t r = 0; r < table->num_rules; r++) {
+        table->by_input[fill[table->rules[r].input]++] = r;
+    }
+    free(fill);
+    return table;
+}
+
+static inline void rule_vote(rule_engine_t *engine, const rule_t *rule, void *ctx) {
+    const uint32_t *outputs = &engine->table->rule_outputs[rule->first_output];
+    for (uint16_t i = 0; i < rule->num_outputs; i++) {
+        uint32_t output = outputs[i];
+        engine->votes[output] += rule->active ? 1 : -1;
+        bool on = engine->votes[output] > 0;
+        if (on != engine->output_on[output]) {
+            engine->output_on[output] = on;
+            engine->transitions++;
+            engine->on_output(engine, (int)output, on, ctx);
+        }
+    }
+}
+
+static inline void rule_evaluate(rule_engine_t *engine, uint32_t index, float value, uint32_t now_ms, void *ctx) {
+    rule_t *rule = &engine->table->rules[index];
+    bool want;
+
+    engine->evaluations++;
+    if (rule->active) {
+        want = rule->greater ? value > rule->release : value < rule->release;
+    } else {
+        want = rule->greater ? value > rule->trip : value < rule->trip;
+    }
+    if (want == rule->active) {
+        rule->pending = 0;
+        return;
+    }
+    if (!rule->pending) {
+        rule->pending = 1;
+        rule->pending_since_ms = now_ms;
+    }
+    if (now_ms - rule->pending_since_ms >= rule->debounce_ms) {
+        rule->active = want;
+        rule->pending = 0;
+        rule_vote(engine, rule, ctx);
+    } else if (!rule->queued) {
+        rule->queued = 1;
+        engine->pending[engine->num_pending++] = index;
+    }
+}
+
+// ctx is handed to the output callback for transitions this update causes
+static inline void rule_engine_update(rule_engine_t *engine, int input, float value, uint32_t now_ms, void *ctx) {
+    rule_table_t *table = engine->table;
+
+    engine->values[input] = value;
+    engine->updates++;
+    if (!table || (uint32_t)input >= table->num_inputs) {
+        return;
+    }
+    for (uint32_t i = table->by_input_start[input]; i < table->by_input_start[input + 1]; i++) {
+        rule_evaluate(engine, table->by_input[i], value, now_ms, ctx);
+    }
+}
+
+// Completes debounces whose time is up; call at least as often as the
+// shortest debounce needs resolving
+static inline void rule_engine_poll(rule_engine_t *engine, uint32_t now_ms) {
+    uint32_t kept = 0;
+
+    for (uint32_t i = 0; i < engine->num_pending; i++) {
+        uint32_t index = engine->pending[i];
+        rule_t *rule = &engine->table->rules[index];
+        if (rule->pending) {
+            rule_evaluate(engine, index, engine->values[rule->input], now_ms, NULL);
+        }
+        if (rule->pending) {
+            engine->pending[kept++] = index;
+        } else {
+            rule->queued = 0;
+        }
+    }
+    engine->num_pending = kept;
+}
+
+// Same condition, debounce and output list
+static inline bool rule_same(const rule_table_t *a_table, const rule_t *a, const rule_table_t *b_table, const rule_t *b) {
+    if (a->input != b->input || a->greater != b->greater || a->trip != b->trip || a->release != b->release
+        || a->debounce_ms != b->debounce_ms || a->num_outputs != b->num_outputs) {
+        return false;
+    }
+    return memcmp(&a_table->rule_outputs[a->first_output], &b_table->rule_outputs[b->first_output],
+                  a->num_outputs * sizeof(uint32_t)) == 0;
+}
+
+// Swaps in a compiled table. A rule identical to one in the old table keeps its
+// state, each old rule passing it on at most once so duplicates pair up in
+// order; a new rule starts from the current input value without debounce.
+static inline void rule_engine_install(rule_engine_t *engine, rule_table_t *table) {
+    rule_table_t *old = engine->table;
+    uint32_t *pending = malloc((table->num_rules + 1) * sizeof(uint32_t));
+    uint8_t *claimed = calloc(old ? old->num_rules + 1 : 1, 1);
+
+    if (!pending || !claimed) {
+        free(pending);
+        free(claimed);
+        rule_table_free(table);
+        return;
+    }
+    for (uint32_t r = 0; r < table->num_rules; r++) {
+        rule_t *rule = &table->rules[r];
+        float value = engine->values[rule->input];
+        bool matched = false;
+        if (old && rule->input < old->num_inputs) {
+            for (uint32_t i = old->by_input_start[rule->input]; i < old->by_input_start[rule->input + 1]; i++) {
+                uint32_t index = old->by_input[i];
+                if (!claimed[index] && rule_same(old, &old->rules[index], table, rule)) {
+                    rule->active = old->rules[index].active;
+                    claimed[index] = 1;
+                    matched = true;
+                    break;
+                }
+            }
+        }
+        if (!matched && !isnan(value)) {
+            rule->active = rule->greater ? value > rule->trip : value < rule->trip;
+        }
+    }
+    free(claimed);
+
+    free(engine->pending);
+    engine->pending = pending;
+    engine->num_pending = 0;
+    engine->table = table;
+    rule_table_free(old);
+
+    memset(engine->votes, 0, engine->outputs.capacity * sizeof(uint32_t));
+    for (uint32_t r = 0; r < table->num_rules; r++) {
+        const rule_t *rule = &table->rules[r];
+        for (uint16_t i = 0; rule->active && i < rule->num_outputs; i++) {
+            engine->votes[table->rule_outputs[rule->first_output + i]]++;
+        }
+    }
+    // Outputs seen for the first time are always reported so relays start from a known state
+    for (uint32_t output = 0; output < engine->outputs.count; output++) {
+        bool on = engine->votes[output] > 0;
+        if (on != engine->output_on[output] || output >= engine->announced) {
+            engine->output_on[output] = on;
+            engine->transitions++;
+            engine->on_output(engine, (int)output, on, NULL);
+        }
+    }
+    engine->announced = engine->outputs.count;
+}
+
+// Loads path, falling back to the built-in defaults when the file is missing;
+// on a parse error the current table stays in place
+static inline bool rule_engine_load(rule_engine_t *engine, const char *path, const char *defaults) {
+    struct stat st;
+    char *text = NULL;
+    const char *source = path;
+
+    engine->path = path;
+    engine->defaults = defaults;
+    if (stat(path, &st) == 0) {
+        FILE *file = fopen(path, "rb");
+        text = malloc((size_t)st.st_size + 1);
+        if (!file || !text || fread(text, 1, (size_t)st.st_size, file) != (size_t)st.st_size) {
+            printf("[ERROR] Cannot read rule file %s.\n", path);
+            if (file) {
+                fclose(file);
+            }
+            free(text);
+            return false;
+        }
+        fclose(file);
+        text[st.st_size] = '\0';
+        engine->mtime = st.st_mtime;
+    } else {
+        source = "built-in rules";
+        engine->mtime = 0;
+    }
+
+    const char *rule_text = text ? text : defaults;
+    char *expanded = engine->expand ? engine->expand(engine, rule_text) : NULL;
+    rule_table_t *table = rule_engine_compile(engine, expanded ? expanded : rule_text, source);
+    free(expanded);
+    free(text);
+    if (!table) {
+        return false;
+    }
+    rule_engine_install(engine, table);
+    if (!engine->quiet) {
+        printf("Rules loaded from %s: %u rules, %u inputs, %u outputs\n", source, table->num_rules, engine->inputs.count, engine->outputs.count);
+    }
+    return true;
+}
+
+// Hot reload: cheap enough to call once a second
+static inline void rule_engine_reload_if_changed(rule_engine_t *engine) {
+    struct stat st;
+    time_t mtime = stat(engine->path, &st) == 0 ? st.st_mtime : 0;
+    if (mtime != engine->mtime) {
+        engine->mtime = mtime;
+        rule_engine_load(engine, engine->path, engine->defaults);
+    }
+}
+
+#endif